@@ -0,0 +1,74 @@
+#include "ColorizerThread.h"
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+ColorizerThread::ColorizerThread(Function aFunction): mFunction(std::move(aFunction)), mThread(&ColorizerThread::Run, this)
+{}
+
+ColorizerThread::~ColorizerThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    mThread.join();
+}
+
+bool ColorizerThread::IsBusy() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueued != nullptr || mRunning || mFinished != nullptr;
+}
+
+void ColorizerThread::Submit(std::unique_ptr<ColorizeJob> aJob)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        assert(mQueued == nullptr && !mRunning && mFinished == nullptr);
+        mQueued = std::move(aJob);
+    }
+    mCondition.notify_all();
+}
+
+std::unique_ptr<ColorizeJob> ColorizerThread::TakeFinished()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return std::move(mFinished);
+}
+
+void ColorizerThread::Wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this] {
+        return mQueued == nullptr && !mRunning;
+    });
+}
+
+void ColorizerThread::Run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;)
+    {
+        mCondition.wait(lock, [this] {
+            return mStop || mQueued != nullptr;
+        });
+        if (mStop)
+        {
+            return;
+        }
+
+        std::unique_ptr<ColorizeJob> job = std::move(mQueued);
+        mRunning = true;
+        lock.unlock();
+
+        mFunction(*job);
+
+        lock.lock();
+        mRunning = false;
+        mFinished = std::move(job);
+        mCondition.notify_all();
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Line.h"
+#include "LineRanges.h"
+
+// A copy of the document lines that have to be scanned or tokenized, colorized off the UI thread.
+// The lines are copied without their style runs and layout caches (see Line::CopyPlanes()). All line
+// numbers are document indices at the time the copy was taken.
+struct ColorizeJob
+{
+        int mLineCount = 0; // document line count when the lines were copied
+        // Lines [mScanFrom, mScanTo) have to be rescanned for comments; the scan continues past them
+        // until a line's saved start state matches, or the copied run [mScanFrom, mScanEnd) ends.
+        // mScanFrom has a known start state.
+        int mScanFrom = 0;
+        int mScanTo = 0;
+        int mScanEnd = 0;
+        // Lines that have to be tokenized. The worker adds those whose preprocessor flags it changed.
+        LineRanges mColorRanges;
+        // The run [mScanFrom, mScanEnd) followed by the other lines of mColorRanges, and their indices
+        std::vector<Line> mLines;
+        std::vector<int> mLineIndices;
+
+        // Set by the worker: the line the scan stopped at, mScanEnd if its state never settled
+        int mScanStop = 0;
+};
+
+// Runs colorization jobs on a background thread, one at a time.
+class ColorizerThread
+{
+    public:
+        using Function = std::function<void(ColorizeJob &)>;
+
+        explicit ColorizerThread(Function aFunction);
+        ~ColorizerThread();
+        ColorizerThread(const ColorizerThread &) = delete;
+        ColorizerThread &operator=(const ColorizerThread &) = delete;
+
+        // True while a job is queued or running, or its result has not been taken yet.
+        bool IsBusy() const;
+        void Submit(std::unique_ptr<ColorizeJob> aJob);
+        // Returns the finished job, or nullptr if there is none (yet).
+        std::unique_ptr<ColorizeJob> TakeFinished();
+        // Blocks until the current job, if any, is finished.
+        void Wait();
+
+    private:
+        void Run();
+
+        Function mFunction;
+        mutable std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::unique_ptr<ColorizeJob> mQueued;
+        std::unique_ptr<ColorizeJob> mFinished;
+        bool mRunning = false;
+        bool mStop = false;
+        std::thread mThread;
+};
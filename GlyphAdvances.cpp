@@ -0,0 +1,92 @@
+#include "GlyphAdvances.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cfloat>
+#include <map>
+#include <utility>
+
+using Tables = std::map<std::pair<const ImFont *, float>, GlyphAdvances>;
+
+static Tables &GetTables()
+{
+    static Tables tables;
+    return tables;
+}
+
+static uint32_t sGeneration = 0;
+
+GlyphAdvances::GlyphAdvances(ImFont *aFont, const float aSize): mFont(aFont), mSize(aSize)
+{
+    for (size_t i = 0; i < mAscii.size(); ++i)
+    {
+        const char c = static_cast<char>(i);
+        mAscii.at(i) = Measure(&c, 1);
+    }
+    mMonospace = std::all_of(mAscii.begin() + ' ', mAscii.begin() + '~' + 1, [this](const float aAdvance) {
+        return aAdvance == mAscii[' '];
+    });
+}
+
+const GlyphAdvances &GlyphAdvances::Get(ImFont *aFont, const float aSize)
+{
+    return GetTables().try_emplace(std::make_pair(aFont, aSize), aFont, aSize).first->second;
+}
+
+void GlyphAdvances::Clear()
+{
+    GetTables().clear();
+    ++sGeneration;
+}
+
+uint32_t GlyphAdvances::GetGeneration()
+{
+    return sGeneration;
+}
+
+float GlyphAdvances::Advance(const char *aGlyph, const int aLength) const
+{
+    assert(aLength >= 1);
+    if (static_cast<unsigned char>(*aGlyph) < mAscii.size())
+    {
+        return mAscii[static_cast<unsigned char>(*aGlyph)];
+    }
+    // Overlong sequences are not valid UTF-8 and do not fit the key
+    if (aLength > 4)
+    {
+        return Measure(aGlyph, aLength);
+    }
+
+    uint32_t key = 0;
+    for (int i = 0; i < aLength; ++i)
+    {
+        key = key << 8 | static_cast<unsigned char>(aGlyph[i]);
+    }
+    const std::unordered_map<uint32_t, float>::const_iterator it = mOther.find(key);
+    if (it != mOther.end())
+    {
+        return it->second;
+    }
+    const float advance = Measure(aGlyph, aLength);
+    mOther.emplace(key, advance);
+    return advance;
+}
+
+float GlyphAdvances::TextWidth(const char *aBegin, const char *aEnd) const
+{
+    float width = 0.0f;
+    for (const char *p = aBegin; p < aEnd;)
+    {
+        const unsigned char c = static_cast<unsigned char>(*p);
+        const int length = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+        const int available = static_cast<int>(std::min<ptrdiff_t>(length, aEnd - p));
+        width += Advance(p, available);
+        p += available;
+    }
+    return width;
+}
+
+float GlyphAdvances::Measure(const char *aGlyph, const int aLength) const
+{
+    return mFont->CalcTextSizeA(mSize, FLT_MAX, -1.0f, aGlyph, aGlyph + aLength, nullptr).x;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include "imgui.h"
+
+// Advance widths of the glyphs of one font at one size.
+// Tables are created on first use and shared by all editors; ASCII characters are measured up
+// front into a flat array, any other glyph the first time it is asked for. Only to be used from
+// the thread that renders with ImGui.
+class GlyphAdvances
+{
+    public:
+        GlyphAdvances(ImFont *aFont, float aSize);
+
+        // The table of aFont at aSize.
+        static const GlyphAdvances &Get(ImFont *aFont, float aSize);
+        // Drops all tables, e.g. after the font atlas was rebuilt.
+        static void Clear();
+        // Changes with every Clear(), so that holders of a table can tell it is gone.
+        static uint32_t GetGeneration();
+
+        float Advance(const char aChar) const
+        {
+            const unsigned char c = static_cast<unsigned char>(aChar);
+            return c < mAscii.size() ? mAscii[c] : Measure(&aChar, 1);
+        }
+        // Advance of the glyph encoded by the UTF-8 sequence [aGlyph, aGlyph + aLength).
+        float Advance(const char *aGlyph, int aLength) const;
+        // Width of the single-line text [aBegin, aEnd).
+        float TextWidth(const char *aBegin, const char *aEnd) const;
+        // True if all printable ASCII characters are equally wide.
+        bool IsMonospace() const
+        {
+            return mMonospace;
+        }
+
+    private:
+        float Measure(const char *aGlyph, int aLength) const;
+
+        ImFont *mFont;
+        float mSize;
+        std::array<float, 128> mAscii{};
+        bool mMonospace;
+        mutable std::unordered_map<uint32_t, float> mOther; // keyed by the glyph's UTF-8 bytes
+};
@@ -6,9 +6,390 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "Line.h"
 #include "Palette.h"
 #include "Types.h"
 
+static bool IsDigit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool IsHexDigit(const char c)
+{
+    return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static bool IsIdentifierStart(const char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool IsIdentifierChar(const char c)
+{
+    return IsIdentifierStart(c) || IsDigit(c);
+}
+
+// A string delimited by aQuote, with backslash escapes. Unterminated strings are not tokens.
+template<typename It>
+static bool TokenizeQuoted(It in_begin, It in_end, It &out_begin, It &out_end, const char aQuote)
+{
+    It p = in_begin;
+    if (*p != aQuote)
+    {
+        return false;
+    }
+    p++;
+
+    while (p < in_end)
+    {
+        if (*p == aQuote)
+        {
+            out_begin = in_begin;
+            out_end = p + 1;
+            return true;
+        }
+        if (*p == '\\' && p + 1 < in_end)
+        {
+            p++;
+        }
+        p++;
+    }
+    return false;
+}
+
+template<typename It>
+static bool TokenizeCStyleString(It in_begin, It in_end, It &out_begin, It &out_end)
+{
+    if (*in_begin == 'L' && in_begin + 1 < in_end && TokenizeQuoted(in_begin + 1, in_end, out_begin, out_end, '"'))
+    {
+        out_begin = in_begin;
+        return true;
+    }
+    return TokenizeQuoted(in_begin, in_end, out_begin, out_end, '"');
+}
+
+template<typename It>
+static bool TokenizeCStyleCharacterLiteral(It in_begin, It in_end, It &out_begin, It &out_end)
+{
+    It p = in_begin;
+    if (*p != '\'')
+    {
+        return false;
+    }
+    p++;
+
+    // handle escape characters
+    if (p < in_end && *p == '\\')
+    {
+        p++;
+    }
+    if (p < in_end)
+    {
+        p++;
+    }
+
+    // handle end of character literal
+    if (p < in_end && *p == '\'')
+    {
+        out_begin = in_begin;
+        out_end = p + 1;
+        return true;
+    }
+    return false;
+}
+
+template<typename It>
+static bool TokenizeCStyleIdentifier(It in_begin, It in_end, It &out_begin, It &out_end)
+{
+    It p = in_begin;
+    if (!IsIdentifierStart(*p))
+    {
+        return false;
+    }
+    p++;
+
+    while (p < in_end && IsIdentifierChar(*p))
+    {
+        p++;
+    }
+
+    out_begin = in_begin;
+    out_end = p;
+    return true;
+}
+
+// Integer and floating point literals. aRadixPrefixes lists the letters allowed after a leading
+// '0' to introduce a non-decimal integer ("xX" for C-style hex literals).
+template<typename It>
+static bool TokenizeCStyleNumber(It in_begin,
+                                 It in_end,
+                                 It &out_begin,
+                                 It &out_end,
+                                 const std::string &aRadixPrefixes)
+{
+    It p = in_begin;
+    if (!IsDigit(*p) && !(*p == '.' && p + 1 < in_end && IsDigit(p[1])))
+    {
+        return false;
+    }
+
+    bool isFloat = false;
+    if (*p == '0' && p + 2 < in_end && aRadixPrefixes.find(p[1]) != std::string::npos)
+    {
+        int radix = 16;
+        switch (p[1])
+        {
+            case 'b':
+            case 'B':
+                radix = 2;
+                break;
+            case 'o':
+            case 'O':
+                radix = 8;
+                break;
+            case 'd':
+            case 'D':
+                radix = 10;
+                break;
+            default:
+                break;
+        }
+
+        It digits = p + 2;
+        It q = digits;
+        while (q < in_end && IsHexDigit(*q) && (radix == 16 || (IsDigit(*q) && *q - '0' < radix)))
+        {
+            q++;
+        }
+        if (q != digits)
+        {
+            p = q;
+        } else
+        {
+            p++; // just the "0"
+        }
+    } else
+    {
+        while (p < in_end && IsDigit(*p))
+        {
+            p++;
+        }
+        if (p < in_end && *p == '.')
+        {
+            isFloat = true;
+            p++;
+            while (p < in_end && IsDigit(*p))
+            {
+                p++;
+            }
+        }
+
+        // floating point exponent, only taken if it has digits
+        if (p < in_end && (*p == 'e' || *p == 'E'))
+        {
+            It q = p + 1;
+            if (q < in_end && (*q == '+' || *q == '-'))
+            {
+                q++;
+            }
+            if (q < in_end && IsDigit(*q))
+            {
+                isFloat = true;
+                while (q < in_end && IsDigit(*q))
+                {
+                    q++;
+                }
+                p = q;
+            }
+        }
+    }
+
+    if (isFloat)
+    {
+        // single and double precision suffixes: f, F, lf, LF
+        if (p < in_end && (*p == 'f' || *p == 'F'))
+        {
+            p++;
+        } else if (p + 1 < in_end && (*p == 'l' || *p == 'L') && (p[1] == 'f' || p[1] == 'F'))
+        {
+            p += 2;
+        }
+    } else
+    {
+        // integer size type
+        if (p < in_end && (*p == 'u' || *p == 'U'))
+        {
+            p++;
+        }
+        for (int i = 0; i < 2 && p < in_end && (*p == 'l' || *p == 'L'); i++)
+        {
+            p++;
+        }
+    }
+
+    out_begin = in_begin;
+    out_end = p;
+    return true;
+}
+
+template<typename It>
+static bool TokenizeCStylePunctuation(It in_begin, It in_end, It &out_begin, It &out_end)
+{
+    (void)in_end;
+
+    switch (*in_begin)
+    {
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        case '!':
+        case '%':
+        case '^':
+        case '&':
+        case '*':
+        case '(':
+        case ')':
+        case '-':
+        case '+':
+        case '=':
+        case '~':
+        case '|':
+        case '<':
+        case '>':
+        case '?':
+        case ':':
+        case '/':
+        case ';':
+        case ',':
+        case '.':
+            out_begin = in_begin;
+            out_end = in_begin + 1;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// '#' followed by the directive name
+template<typename It>
+static bool TokenizePreprocessorDirective(It in_begin, It in_end, It &out_begin, It &out_end)
+{
+    It p = in_begin;
+    if (*p != '#')
+    {
+        return false;
+    }
+    p++;
+
+    while (p < in_end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    It name = p;
+    while (p < in_end && IsIdentifierStart(*p))
+    {
+        p++;
+    }
+    if (p == name)
+    {
+        return false;
+    }
+
+    out_begin = in_begin;
+    out_end = p;
+    return true;
+}
+
+// Skips blanks; returns true (with an empty Default token) if nothing but blanks is left
+template<typename It>
+static bool SkipBlanks(It &in_begin, It in_end, It &out_begin, It &out_end, PaletteIndex &paletteIndex)
+{
+    while (in_begin < in_end && (*in_begin == ' ' || *in_begin == '\t'))
+    {
+        in_begin++;
+    }
+    if (in_begin == in_end)
+    {
+        out_begin = in_end;
+        out_end = in_end;
+        paletteIndex = PaletteIndex::Default;
+        return true;
+    }
+    return false;
+}
+
+template<typename It>
+static bool TokenizeGLSL(It in_begin,
+                         It in_end,
+                         It &out_begin,
+                         It &out_end,
+                         PaletteIndex &paletteIndex)
+{
+    if (SkipBlanks(in_begin, in_end, out_begin, out_end, paletteIndex))
+    {
+        return true;
+    }
+
+    if (TokenizePreprocessorDirective(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::Preprocessor;
+    } else if (TokenizeCStyleString(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::String;
+    } else if (TokenizeCStyleCharacterLiteral(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::CharLiteral;
+    } else if (TokenizeCStyleIdentifier(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::Identifier;
+    } else if (TokenizeCStyleNumber(in_begin, in_end, out_begin, out_end, "xX"))
+    {
+        paletteIndex = PaletteIndex::Number;
+    } else if (TokenizeCStylePunctuation(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::Punctuation;
+    } else
+    {
+        return false;
+    }
+    return true;
+}
+
+template<typename It>
+static bool TokenizeAngelScript(It in_begin,
+                                It in_end,
+                                It &out_begin,
+                                It &out_end,
+                                PaletteIndex &paletteIndex)
+{
+    if (SkipBlanks(in_begin, in_end, out_begin, out_end, paletteIndex))
+    {
+        return true;
+    }
+
+    // Single quoted literals are strings in AngelScript
+    if (TokenizeCStyleString(in_begin, in_end, out_begin, out_end) ||
+        TokenizeQuoted(in_begin, in_end, out_begin, out_end, '\''))
+    {
+        paletteIndex = PaletteIndex::String;
+    } else if (TokenizeCStyleIdentifier(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::Identifier;
+    } else if (TokenizeCStyleNumber(in_begin, in_end, out_begin, out_end, "xXbBoOdD"))
+    {
+        paletteIndex = PaletteIndex::Number;
+    } else if (TokenizeCStylePunctuation(in_begin, in_end, out_begin, out_end))
+    {
+        paletteIndex = PaletteIndex::Punctuation;
+    } else
+    {
+        return false;
+    }
+    return true;
+}
+
 const LanguageDefinition &LanguageDefinition::GLSL()
 {
     static bool inited = false;
@@ -396,6 +777,9 @@ const LanguageDefinition &LanguageDefinition::GLSL()
         langDef.mCaseSensitive = true;
         langDef.mAutoIndentation = true;
 
+        langDef.mTokenize = TokenizeGLSL<const char *>;
+        langDef.mTokenizeLine = TokenizeGLSL<Line::CharIterator>;
+
         langDef.mName = "GLSL";
 
         inited = true;
@@ -470,6 +854,9 @@ const LanguageDefinition &LanguageDefinition::AngelScript()
         langDef.mCaseSensitive = true;
         langDef.mAutoIndentation = true;
 
+        langDef.mTokenize = TokenizeAngelScript<const char *>;
+        langDef.mTokenizeLine = TokenizeAngelScript<Line::CharIterator>;
+
         langDef.mName = "AngelScript";
 
         inited = true;
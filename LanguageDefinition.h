@@ -4,8 +4,15 @@
 
 #pragma once
 #include <string>
+#include "Line.h"
 #include "Types.h"
 
+using LineTokenizeCallback = bool (*)(Line::CharIterator in_begin,
+                                      Line::CharIterator in_end,
+                                      Line::CharIterator &out_begin,
+                                      Line::CharIterator &out_end,
+                                      PaletteIndex &paletteIndex);
+
 class LanguageDefinition
 {
     public:
@@ -18,6 +25,9 @@ class LanguageDefinition
         bool mAutoIndentation = true;
 
         TokenizeCallback mTokenize = nullptr;
+        // The same tokenizer reading a line in place, across its gap. If only mTokenize is set, lines
+        // whose bytes are not contiguous are copied out for it.
+        LineTokenizeCallback mTokenizeLine = nullptr;
 
         TokenRegexStrings mTokenRegexStrings;
 
@@ -0,0 +1,290 @@
+#include "Line.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include "Palette.h"
+
+// Copies the logical range [aFrom, aTo) of a plane whose gap is [aGapStart, aGapEnd) to aDest
+template<typename T>
+static void CopyLogical(const T *aSrc, const size_t aGapStart, const size_t aGapEnd, size_t aFrom, const size_t aTo, T *aDest)
+{
+    if (aFrom < aGapStart)
+    {
+        const size_t n = std::min(aTo, aGapStart) - aFrom;
+        memcpy(aDest, aSrc + aFrom, n * sizeof(T));
+        aDest += n;
+        aFrom += n;
+    }
+    if (aFrom < aTo)
+    {
+        memcpy(aDest, aSrc + aFrom + (aGapEnd - aGapStart), (aTo - aFrom) * sizeof(T));
+    }
+}
+
+// Number of bytes in [aChars, aChars + aCount) that are not printable ASCII
+static size_t CountNonPrintable(const char *aChars, const size_t aCount)
+{
+    return static_cast<size_t>(std::count_if(aChars, aChars + aCount, [](const char c) {
+        return static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) > 0x7E;
+    }));
+}
+
+Line::Line(std::string aChars):
+    mChars(std::move(aChars)),
+    mColors(mChars.size(), PaletteIndex::Default),
+    mFlags(mChars.size(), 0),
+    mGapStart(mChars.size()),
+    mGapEnd(mChars.size()),
+    mNonPrintableCount(CountNonPrintable(mChars.data(), mChars.size()))
+{}
+
+void Line::reserve(const size_t aCapacity)
+{
+    if (aCapacity > size())
+    {
+        ReserveGap(aCapacity - size());
+    }
+}
+
+void Line::clear()
+{
+    std::string().swap(mChars);
+    std::vector<PaletteIndex>().swap(mColors);
+    std::vector<uint8_t>().swap(mFlags);
+    mGapStart = mGapEnd = 0;
+    mNonPrintableCount = 0;
+    mLayoutKey = 0;
+    mMesh.reset();
+    mStyleRunsValid = false;
+}
+
+void Line::insert(const size_t aIndex, const char *aChars, const size_t aCount, const PaletteIndex aColor)
+{
+    assert(aIndex <= size());
+
+    MoveGap(aIndex);
+    ReserveGap(aCount);
+    memcpy(mChars.data() + mGapStart, aChars, aCount);
+    std::fill_n(mColors.data() + mGapStart, aCount, aColor);
+    std::fill_n(mFlags.data() + mGapStart, aCount, 0);
+    mNonPrintableCount += CountNonPrintable(aChars, aCount);
+    mGapStart += aCount;
+    mLayoutKey = 0;
+    mMesh.reset();
+    mStyleRunsValid = false;
+}
+
+void Line::insert(const size_t aIndex, const Line &aOther, const size_t aFrom, const size_t aTo)
+{
+    assert(aIndex <= size());
+    assert(aFrom <= aTo && aTo <= aOther.size());
+    assert(&aOther != this);
+
+    const size_t count = aTo - aFrom;
+    MoveGap(aIndex);
+    ReserveGap(count);
+    CopyLogical(aOther.mChars.data(), aOther.mGapStart, aOther.mGapEnd, aFrom, aTo, mChars.data() + mGapStart);
+    CopyLogical(aOther.mColors.data(), aOther.mGapStart, aOther.mGapEnd, aFrom, aTo, mColors.data() + mGapStart);
+    CopyLogical(aOther.mFlags.data(), aOther.mGapStart, aOther.mGapEnd, aFrom, aTo, mFlags.data() + mGapStart);
+    mNonPrintableCount += aOther.IsPrintableAscii() ? 0 : CountNonPrintable(mChars.data() + mGapStart, count);
+    mGapStart += count;
+    mLayoutKey = 0;
+    mMesh.reset();
+    mStyleRunsValid = false;
+}
+
+void Line::erase(const size_t aFrom, const size_t aTo)
+{
+    assert(aFrom <= aTo && aTo <= size());
+
+    // Deleting just widens the gap
+    MoveGap(aFrom);
+    if (mNonPrintableCount != 0)
+    {
+        mNonPrintableCount -= CountNonPrintable(mChars.data() + mGapEnd, aTo - aFrom);
+    }
+    mGapEnd += aTo - aFrom;
+
+    // Give the storage back once the line has shrunk to a fraction of it
+    if (mChars.size() > 64 && mChars.size() > size() * 4)
+    {
+        Reallocate(std::max(size() * 2, static_cast<size_t>(16)));
+    }
+    mLayoutKey = 0;
+    mMesh.reset();
+    mStyleRunsValid = false;
+}
+
+uint8_t Line::GetStyle(const PaletteIndex aColor, const uint8_t aFlags)
+{
+    if ((aFlags & static_cast<uint8_t>(GlyphFlag::Comment)) != 0)
+    {
+        return static_cast<uint8_t>(PaletteIndex::Comment);
+    }
+    if ((aFlags & static_cast<uint8_t>(GlyphFlag::MultiLineComment)) != 0)
+    {
+        return static_cast<uint8_t>(PaletteIndex::MultiLineComment);
+    }
+    const uint8_t style = static_cast<uint8_t>(aColor);
+    return (aFlags & static_cast<uint8_t>(GlyphFlag::Preprocessor)) != 0 ? style | kStylePreprocessor : style;
+}
+
+void Line::UpdateStyleRuns()
+{
+    mStyleRuns.clear();
+    const size_t count = size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t p = Physical(i);
+        const uint8_t style = GetStyle(mColors[p], mFlags[p]);
+        const bool tab = mChars[p] == '\t';
+        // Runs only start at the first byte of a glyph
+        const bool continuation = (static_cast<unsigned char>(mChars[p]) & 0xC0) == 0x80;
+        if (mStyleRuns.empty() ||
+            (!continuation &&
+             (mStyleRuns.back().mStyle != style || (mChars[Physical(mStyleRuns.back().mStart)] == '\t') != tab)))
+        {
+            mStyleRuns.push_back({static_cast<uint32_t>(i), 0, style});
+        }
+        ++mStyleRuns.back().mLength;
+    }
+    mStyleRunsValid = true;
+    mMesh.reset();
+}
+
+void Line::CopyStyle(const Line &aOther)
+{
+    assert(aOther.size() == size());
+    for (size_t i = 0; i < size(); ++i)
+    {
+        const size_t p = Physical(i);
+        const size_t q = aOther.Physical(i);
+        mColors[p] = aOther.mColors[q];
+        mFlags[p] = aOther.mFlags[q];
+    }
+    mStyleRuns = aOther.mStyleRuns;
+    mStyleRunsValid = aOther.mStyleRunsValid;
+    mMesh.reset();
+}
+
+bool Line::HasSameStyle(const Line &aOther) const
+{
+    assert(aOther.size() == size());
+    for (size_t i = 0; i < size(); ++i)
+    {
+        const size_t p = Physical(i);
+        const size_t q = aOther.Physical(i);
+        if (mColors[p] != aOther.mColors[q] || mFlags[p] != aOther.mFlags[q])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Line Line::CopyPlanes() const
+{
+    Line result;
+    const size_t count = size();
+    result.mChars.reserve(count);
+    AppendChars(result.mChars, 0, count);
+    result.mColors.resize(count);
+    result.mFlags.resize(count);
+    CopyLogical(mColors.data(), mGapStart, mGapEnd, 0, count, result.mColors.data());
+    CopyLogical(mFlags.data(), mGapStart, mGapEnd, 0, count, result.mFlags.data());
+    result.mGapStart = result.mGapEnd = count;
+    result.mScanState = mScanState;
+    result.mNonPrintableCount = mNonPrintableCount;
+    return result;
+}
+
+void Line::FillColor(const size_t aFrom, const size_t aTo, const PaletteIndex aColor)
+{
+    assert(aFrom <= aTo && aTo <= size());
+
+    // The part before the gap, then the part after it
+    const size_t split = std::clamp(mGapStart, aFrom, aTo);
+    std::fill(mColors.begin() + aFrom, mColors.begin() + split, aColor);
+    std::fill(mColors.begin() + Physical(split), mColors.begin() + Physical(split) + (aTo - split), aColor);
+}
+
+void Line::AppendChars(std::string &aOut, const size_t aFrom, const size_t aTo) const
+{
+    assert(aFrom <= aTo && aTo <= size());
+
+    const size_t split = std::clamp(mGapStart, aFrom, aTo);
+    aOut.append(mChars, aFrom, split - aFrom);
+    aOut.append(mChars, Physical(split), aTo - split);
+}
+
+void Line::MoveGap(const size_t aIndex)
+{
+    assert(aIndex <= size());
+
+    if (aIndex < mGapStart)
+    {
+        // Shift [aIndex, mGapStart) to the end of the gap
+        const size_t n = mGapStart - aIndex;
+        memmove(mChars.data() + mGapEnd - n, mChars.data() + aIndex, n);
+        memmove(mColors.data() + mGapEnd - n, mColors.data() + aIndex, n * sizeof(PaletteIndex));
+        memmove(mFlags.data() + mGapEnd - n, mFlags.data() + aIndex, n);
+        mGapStart -= n;
+        mGapEnd -= n;
+    } else if (aIndex > mGapStart)
+    {
+        // Shift the n glyphs after the gap to its start
+        const size_t n = aIndex - mGapStart;
+        memmove(mChars.data() + mGapStart, mChars.data() + mGapEnd, n);
+        memmove(mColors.data() + mGapStart, mColors.data() + mGapEnd, n * sizeof(PaletteIndex));
+        memmove(mFlags.data() + mGapStart, mFlags.data() + mGapEnd, n);
+        mGapStart += n;
+        mGapEnd += n;
+    }
+}
+
+void Line::ReserveGap(const size_t aCount)
+{
+    const size_t gap = mGapEnd - mGapStart;
+    if (gap >= aCount)
+    {
+        return;
+    }
+
+    // Grow geometrically and move the part after the gap to the new end
+    const size_t oldPhysical = mChars.size();
+    const size_t newPhysical = std::max({oldPhysical * 2, oldPhysical + aCount - gap, static_cast<size_t>(16)});
+    const size_t tail = oldPhysical - mGapEnd;
+    mChars.resize(newPhysical);
+    mColors.resize(newPhysical);
+    mFlags.resize(newPhysical);
+    memmove(mChars.data() + newPhysical - tail, mChars.data() + mGapEnd, tail);
+    memmove(mColors.data() + newPhysical - tail, mColors.data() + mGapEnd, tail * sizeof(PaletteIndex));
+    memmove(mFlags.data() + newPhysical - tail, mFlags.data() + mGapEnd, tail);
+    mGapEnd = newPhysical - tail;
+}
+
+void Line::Reallocate(const size_t aPhysical)
+{
+    assert(aPhysical >= size());
+
+    // Keep the gap where it is, sized to fill the new storage
+    const size_t tail = mChars.size() - mGapEnd;
+    const size_t gapEnd = aPhysical - tail;
+    std::string chars(aPhysical, '\0');
+    std::vector<PaletteIndex> colors(aPhysical);
+    std::vector<uint8_t> flags(aPhysical);
+    memcpy(chars.data(), mChars.data(), mGapStart);
+    memcpy(colors.data(), mColors.data(), mGapStart * sizeof(PaletteIndex));
+    memcpy(flags.data(), mFlags.data(), mGapStart);
+    memcpy(chars.data() + gapEnd, mChars.data() + mGapEnd, tail);
+    memcpy(colors.data() + gapEnd, mColors.data() + mGapEnd, tail * sizeof(PaletteIndex));
+    memcpy(flags.data() + gapEnd, mFlags.data() + mGapEnd, tail);
+    mChars = std::move(chars);
+    mColors = std::move(colors);
+    mFlags = std::move(flags);
+    mGapEnd = gapEnd;
+}
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "imgui.h"
+#include "Palette.h"
+#include "Types.h"
+
+// A single line of text.
+// The glyphs are stored as parallel planes: the UTF-8 bytes sit in one contiguous array, the
+// color index and the comment/preprocessor flags of each byte in arrays of their own. Tokenizers,
+// search and text extraction work directly on the byte plane, and loops that only need the text
+// (or only the colors) do not have to pull the other planes through the cache.
+//
+// The planes are gap buffers: the free capacity is kept at the position of the last edit, so
+// repeated typing or deleting at one place of a long line does not move the rest of the line.
+// Indexed accessors and the byte iterators skip over the gap, so that tokenizing, scanning and
+// copying text out leave it where it is. The storage is given back as a line shrinks.
+class Line
+{
+    public:
+        Line() = default;
+        explicit Line(std::string aChars);
+
+        size_t size() const
+        {
+            return mChars.size() - (mGapEnd - mGapStart);
+        }
+        bool empty() const
+        {
+            return size() == 0;
+        }
+        void reserve(size_t aCapacity);
+        void clear();
+
+        Char GetChar(const size_t aIndex) const
+        {
+            assert(aIndex < size());
+            return static_cast<Char>(mChars[Physical(aIndex)]);
+        }
+        PaletteIndex GetColorIndex(const size_t aIndex) const
+        {
+            assert(aIndex < size());
+            return mColors[Physical(aIndex)];
+        }
+        void SetColorIndex(const size_t aIndex, const PaletteIndex aColor)
+        {
+            assert(aIndex < size());
+            mColors[Physical(aIndex)] = aColor;
+        }
+        uint8_t GetFlags(const size_t aIndex) const
+        {
+            assert(aIndex < size());
+            return mFlags[Physical(aIndex)];
+        }
+        bool HasFlag(const size_t aIndex, const GlyphFlag aFlag) const
+        {
+            return (GetFlags(aIndex) & static_cast<uint8_t>(aFlag)) != 0;
+        }
+        void SetFlag(const size_t aIndex, const GlyphFlag aFlag, const bool aValue)
+        {
+            assert(aIndex < size());
+            uint8_t &flags = mFlags[Physical(aIndex)];
+            if (aValue)
+            {
+                flags |= static_cast<uint8_t>(aFlag);
+            } else
+            {
+                flags &= static_cast<uint8_t>(~static_cast<uint8_t>(aFlag));
+            }
+        }
+
+        // Sets the color of the bytes [aFrom, aTo).
+        void FillColor(size_t aFrom, size_t aTo, PaletteIndex aColor);
+        // Appends the bytes [aFrom, aTo) to aOut.
+        void AppendChars(std::string &aOut, size_t aFrom, size_t aTo) const;
+
+        // Random access to the bytes, skipping over the gap, for tokenizers written against char
+        // pointers to work on the line in place
+        class CharIterator
+        {
+            public:
+                using iterator_category = std::random_access_iterator_tag;
+                using value_type = char;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const char *;
+                using reference = const char &;
+
+                CharIterator() = default;
+
+                reference operator*() const
+                {
+                    return mLine->mChars[mLine->Physical(mIndex)];
+                }
+                reference operator[](const difference_type aOffset) const
+                {
+                    return *(*this + aOffset);
+                }
+                CharIterator &operator++()
+                {
+                    ++mIndex;
+                    return *this;
+                }
+                CharIterator operator++(int)
+                {
+                    const CharIterator result = *this;
+                    ++mIndex;
+                    return result;
+                }
+                CharIterator &operator--()
+                {
+                    --mIndex;
+                    return *this;
+                }
+                CharIterator operator--(int)
+                {
+                    const CharIterator result = *this;
+                    --mIndex;
+                    return result;
+                }
+                CharIterator &operator+=(const difference_type aOffset)
+                {
+                    mIndex += aOffset;
+                    return *this;
+                }
+                CharIterator &operator-=(const difference_type aOffset)
+                {
+                    mIndex -= aOffset;
+                    return *this;
+                }
+                CharIterator operator+(const difference_type aOffset) const
+                {
+                    return CharIterator(mLine, mIndex + aOffset);
+                }
+                friend CharIterator operator+(const difference_type aOffset, const CharIterator &aIt)
+                {
+                    return aIt + aOffset;
+                }
+                CharIterator operator-(const difference_type aOffset) const
+                {
+                    return CharIterator(mLine, mIndex - aOffset);
+                }
+                difference_type operator-(const CharIterator &aOther) const
+                {
+                    return static_cast<difference_type>(mIndex) - static_cast<difference_type>(aOther.mIndex);
+                }
+                bool operator==(const CharIterator &aOther) const
+                {
+                    return mIndex == aOther.mIndex;
+                }
+                auto operator<=>(const CharIterator &aOther) const
+                {
+                    return mIndex <=> aOther.mIndex;
+                }
+
+            private:
+                friend class Line;
+                CharIterator(const Line *aLine, const size_t aIndex):
+                    mLine(aLine),
+                    mIndex(aIndex)
+                {}
+
+                const Line *mLine = nullptr;
+                size_t mIndex = 0;
+        };
+        CharIterator begin() const
+        {
+            return {this, 0};
+        }
+        CharIterator end() const
+        {
+            return {this, size()};
+        }
+
+        // Inserts raw bytes with the given color and no flags.
+        void insert(size_t aIndex, const char *aChars, size_t aCount, PaletteIndex aColor = PaletteIndex::Default);
+        // Inserts the glyphs [aFrom, aTo) of aOther, including their colors and flags.
+        void insert(size_t aIndex, const Line &aOther, size_t aFrom, size_t aTo);
+        void append(const Line &aOther, const size_t aFrom, const size_t aTo)
+        {
+            insert(size(), aOther, aFrom, aTo);
+        }
+        void append(const Line &aOther)
+        {
+            insert(size(), aOther, 0, aOther.size());
+        }
+        // Removes the glyphs [aFrom, aTo).
+        void erase(size_t aFrom, size_t aTo);
+
+        // State of the editor's comment/preprocessor scanner at the start of the line, saved so
+        // that rescanning after an edit can stop as soon as it reaches a line whose state is unchanged.
+        static constexpr uint8_t kUnknownScanState = 0xFF;
+        uint8_t GetScanState() const
+        {
+            return mScanState;
+        }
+        void SetScanState(const uint8_t aState)
+        {
+            mScanState = aState;
+        }
+
+        // A run of glyphs drawn in one style: the palette index they are drawn in, with kStylePreprocessor
+        // set if that color is blended with the preprocessor color. Runs hold either only tabs or none.
+        struct StyleRun
+        {
+                uint32_t mStart;
+                uint32_t mLength;
+                uint8_t mStyle;
+        };
+        static constexpr uint8_t kStylePreprocessor = 0x80;
+        // The style a glyph of the given color and flags is drawn in.
+        static uint8_t GetStyle(PaletteIndex aColor, uint8_t aFlags);
+
+        // The runs of equally styled glyphs covering the line, built by UpdateStyleRuns(). Any change to
+        // the text drops them; changes to the colors or flags have to be followed by UpdateStyleRuns().
+        bool HasStyleRuns() const
+        {
+            return mStyleRunsValid;
+        }
+        const std::vector<StyleRun> &GetStyleRuns() const
+        {
+            assert(mStyleRunsValid);
+            return mStyleRuns;
+        }
+        void UpdateStyleRuns();
+        // Copies the colors, flags and style runs of aOther, which holds the same text.
+        void CopyStyle(const Line &aOther);
+        // True if aOther, which holds the same text, has the same colors and flags.
+        bool HasSameStyle(const Line &aOther) const;
+        // A copy of the text, colors, flags and scan state, without the style runs and the caches.
+        Line CopyPlanes() const;
+
+        // The bytes [aFrom, aTo), or nullptr if they straddle the gap.
+        const char *CharRange(const size_t aFrom, const size_t aTo) const
+        {
+            assert(aFrom <= aTo && aTo <= size());
+            if (aFrom < mGapStart && aTo > mGapStart)
+            {
+                return nullptr;
+            }
+            return mChars.data() + Physical(aFrom);
+        }
+
+        // The width the editor counted the line with towards its longest line, negative if not counted
+        // with aKey, which tells counts made with another font, size or tab width apart.
+        float GetWidth(const uint32_t aKey) const
+        {
+            return mWidthKey == aKey ? mWidth : -1.0f;
+        }
+        void SetWidth(const float aWidth, const uint32_t aKey)
+        {
+            mWidth = aWidth;
+            mWidthKey = aKey;
+        }
+
+        // True if the line holds nothing but printable ASCII: no tabs, control characters or UTF-8
+        // sequences, so that every byte is a glyph of its own and one column wide.
+        bool IsPrintableAscii() const
+        {
+            return mNonPrintableCount == 0;
+        }
+
+        // The x offset of every byte's glyph from the start of the line, followed by the width of the
+        // line, as measured by the editor. Any change to the text drops it; aKey tells layouts
+        // measured with another font, size or tab width apart and is never 0.
+        const std::vector<float> *GetLayout(const uint32_t aKey) const
+        {
+            return mLayoutKey == aKey ? &mLayout : nullptr;
+        }
+        // Returns the (emptied) layout storage, to be filled in for aKey.
+        std::vector<float> &ResetLayout(const uint32_t aKey) const
+        {
+            assert(aKey != 0);
+            mLayoutKey = aKey;
+            mLayout.clear();
+            mWrapKey = 0;
+            return mLayout;
+        }
+        // Drops the layout and frees its storage, along with the wraps and the mesh.
+        void ClearLayout() const
+        {
+            mLayoutKey = 0;
+            std::vector<float>().swap(mLayout);
+            mWrapKey = 0;
+            std::vector<uint32_t>().swap(mWraps);
+            mMesh.reset();
+        }
+
+        // The byte each screen row after the first starts at when the editor wraps the line, computed
+        // from its layout and dropped along with it; aKey tells wraps at another width apart.
+        const std::vector<uint32_t> *GetWraps(const uint32_t aKey) const
+        {
+            return mLayoutKey != 0 && mWrapKey == aKey ? &mWraps : nullptr;
+        }
+        // Returns the (emptied) wrap storage, to be filled in for aKey.
+        std::vector<uint32_t> &ResetWraps(const uint32_t aKey) const
+        {
+            assert(aKey != 0);
+            mWrapKey = aKey;
+            mWraps.clear();
+            return mWraps;
+        }
+
+        // The vertices and indices the editor drew the line's text with, relative to the start of the
+        // text and to the first vertex, so that an unchanged line can be drawn again by copying them.
+        // Any change to the text or its styles drops it; aKey tells meshes drawn with another font,
+        // palette or horizontal clipping apart. Copies of the line share the mesh, which is immutable.
+        struct Mesh
+        {
+                uint32_t mKey = 0;
+                std::vector<ImDrawVert> mVertices;
+                std::vector<ImDrawIdx> mIndices;
+        };
+        const Mesh *GetMesh(const uint32_t aKey) const
+        {
+            return mMesh != nullptr && mMesh->mKey == aKey ? mMesh.get() : nullptr;
+        }
+        void SetMesh(std::shared_ptr<const Mesh> aMesh) const
+        {
+            mMesh = std::move(aMesh);
+        }
+
+    private:
+        size_t Physical(const size_t aIndex) const
+        {
+            return aIndex < mGapStart ? aIndex : aIndex + (mGapEnd - mGapStart);
+        }
+        void MoveGap(size_t aIndex);
+        void ReserveGap(size_t aCount);
+        void Reallocate(size_t aPhysical);
+
+        // Physical storage, the bytes in [mGapStart, mGapEnd) are unused
+        std::string mChars;
+        std::vector<PaletteIndex> mColors;
+        std::vector<uint8_t> mFlags;
+        size_t mGapStart = 0;
+        size_t mGapEnd = 0;
+
+        uint8_t mScanState = kUnknownScanState;
+        size_t mNonPrintableCount = 0; // bytes outside of printable ASCII
+        float mWidth = -1.0f;
+        uint32_t mWidthKey = 0;
+        std::vector<StyleRun> mStyleRuns;
+        bool mStyleRunsValid = false;
+
+        // Cached by const editor queries, hence mutable
+        mutable std::vector<float> mLayout;
+        mutable uint32_t mLayoutKey = 0;
+        mutable std::vector<uint32_t> mWraps;
+        mutable uint32_t mWrapKey = 0;
+        mutable std::shared_ptr<const Mesh> mMesh;
+};
@@ -0,0 +1,142 @@
+#include "LineRanges.h"
+#include <algorithm>
+#include <vector>
+
+std::vector<LineRanges::Range>::iterator LineRanges::LowerBound(const int aLine)
+{
+    return std::ranges::lower_bound(mRanges, aLine, {}, &Range::mTo);
+}
+
+std::vector<LineRanges::Range>::const_iterator LineRanges::LowerBound(const int aLine) const
+{
+    return std::ranges::lower_bound(mRanges, aLine, {}, &Range::mTo);
+}
+
+void LineRanges::Add(const int aFrom, const int aTo)
+{
+    if (aFrom >= aTo)
+    {
+        return;
+    }
+
+    const std::vector<Range>::iterator first = LowerBound(aFrom);
+    std::vector<Range>::iterator last = first;
+    while (last != mRanges.end() && last->mFrom <= aTo)
+    {
+        ++last;
+    }
+
+    if (first == last)
+    {
+        mRanges.insert(first, Range{aFrom, aTo});
+        return;
+    }
+
+    first->mFrom = std::min(first->mFrom, aFrom);
+    first->mTo = std::max((last - 1)->mTo, aTo);
+    mRanges.erase(first + 1, last);
+}
+
+void LineRanges::Remove(const int aFrom, const int aTo)
+{
+    if (aFrom >= aTo)
+    {
+        return;
+    }
+
+    std::vector<Range>::iterator it = LowerBound(aFrom + 1);
+    if (it == mRanges.end())
+    {
+        return;
+    }
+
+    if (it->mFrom < aFrom)
+    {
+        if (it->mTo > aTo)
+        {
+            const int to = it->mTo;
+            it->mTo = aFrom;
+            mRanges.insert(it + 1, Range{aTo, to});
+            return;
+        }
+        it->mTo = aFrom;
+        ++it;
+    }
+
+    std::vector<Range>::iterator last = it;
+    while (last != mRanges.end() && last->mTo <= aTo)
+    {
+        ++last;
+    }
+    it = mRanges.erase(it, last);
+
+    if (it != mRanges.end() && it->mFrom < aTo)
+    {
+        it->mFrom = aTo;
+    }
+}
+
+bool LineRanges::Contains(const int aLine) const
+{
+    const std::vector<Range>::const_iterator it = LowerBound(aLine + 1);
+    return it != mRanges.end() && it->mFrom <= aLine;
+}
+
+bool LineRanges::Contains(const int aFrom, const int aTo) const
+{
+    if (aFrom >= aTo)
+    {
+        return true;
+    }
+    const std::vector<Range>::const_iterator it = LowerBound(aFrom + 1);
+    return it != mRanges.end() && it->mFrom <= aFrom && it->mTo >= aTo;
+}
+
+LineRanges::Range LineRanges::First(const int aFrom, const int aTo) const
+{
+    const std::vector<Range>::const_iterator it = LowerBound(aFrom + 1);
+    if (it == mRanges.end() || it->mFrom >= aTo)
+    {
+        return {};
+    }
+    return Range{std::max(it->mFrom, aFrom), std::min(it->mTo, aTo)};
+}
+
+void LineRanges::InsertLines(const int aIndex, const int aCount)
+{
+    for (std::vector<Range>::iterator it = LowerBound(aIndex + 1); it != mRanges.end(); ++it)
+    {
+        if (it->mFrom >= aIndex)
+        {
+            it->mFrom += aCount;
+        }
+        it->mTo += aCount;
+    }
+}
+
+void LineRanges::EraseLines(const int aFirst, const int aLast)
+{
+    const int count = aLast - aFirst;
+    auto shift = [aFirst, aLast, count](const int aLine) {
+        return aLine <= aFirst ? aLine : (aLine <= aLast ? aFirst : aLine - count);
+    };
+
+    // Ranges within the removed lines become empty and ones on either side of them may now touch
+    std::vector<Range>::iterator out = LowerBound(aFirst);
+    for (std::vector<Range>::iterator it = out; it != mRanges.end(); ++it)
+    {
+        const Range range{shift(it->mFrom), shift(it->mTo)};
+        if (range.empty())
+        {
+            continue;
+        }
+        if (out != mRanges.begin() && (out - 1)->mTo >= range.mFrom)
+        {
+            (out - 1)->mTo = std::max((out - 1)->mTo, range.mTo);
+        } else
+        {
+            *out++ = range;
+        }
+    }
+    mRanges.erase(out, mRanges.end());
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+
+// A set of line indices, stored as sorted, disjoint half-open ranges. Ranges that overlap or
+// touch are merged, so scattered lines stay separate while a run of adjacent ones is one range.
+class LineRanges
+{
+    public:
+        struct Range
+        {
+                int mFrom = 0;
+                int mTo = 0;
+
+                bool empty() const
+                {
+                    return mFrom >= mTo;
+                }
+        };
+
+        using const_iterator = std::vector<Range>::const_iterator;
+
+        bool empty() const
+        {
+            return mRanges.empty();
+        }
+        void clear()
+        {
+            mRanges.clear();
+        }
+        const_iterator begin() const
+        {
+            return mRanges.begin();
+        }
+        const_iterator end() const
+        {
+            return mRanges.end();
+        }
+
+        // Adds the lines [aFrom, aTo).
+        void Add(int aFrom, int aTo);
+        // Removes the lines [aFrom, aTo).
+        void Remove(int aFrom, int aTo);
+        bool Contains(int aLine) const;
+        // True if all of the lines [aFrom, aTo) are in the set.
+        bool Contains(int aFrom, int aTo) const;
+        // The first range that overlaps [aFrom, aTo), clipped to it; empty if there is none.
+        Range First(int aFrom = 0, int aTo = std::numeric_limits<int>::max()) const;
+
+        // Follow aCount lines inserted before line aIndex. A range that aIndex splits grows.
+        void InsertLines(int aIndex, int aCount);
+        // Follow the lines [aFirst, aLast) being removed.
+        void EraseLines(int aFirst, int aLast);
+
+    private:
+        // The first range that ends at or after aLine
+        std::vector<Range>::iterator LowerBound(int aLine);
+        std::vector<Range>::const_iterator LowerBound(int aLine) const;
+
+        std::vector<Range> mRanges;
+};
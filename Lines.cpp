@@ -0,0 +1,406 @@
+#include "Lines.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Types.h"
+
+Lines::~Lines()
+{
+    Destroy(mRoot);
+}
+
+Lines::Lines(const Lines &aOther): mRoot(Clone(aOther.mRoot)), mSeed(aOther.mSeed) {}
+
+Lines::Lines(Lines &&aOther) noexcept: mRoot(std::exchange(aOther.mRoot, nullptr)), mSeed(aOther.mSeed) {}
+
+Lines &Lines::operator=(const Lines &aOther)
+{
+    if (this != &aOther)
+    {
+        Node *root = Clone(aOther.mRoot);
+        Destroy(mRoot);
+        mRoot = root;
+        mSeed = aOther.mSeed;
+    }
+    return *this;
+}
+
+Lines &Lines::operator=(Lines &&aOther) noexcept
+{
+    if (this != &aOther)
+    {
+        Destroy(mRoot);
+        mRoot = std::exchange(aOther.mRoot, nullptr);
+        mSeed = aOther.mSeed;
+    }
+    return *this;
+}
+
+Line &Lines::at(const size_t aIndex)
+{
+    return Find(aIndex)->mLine;
+}
+
+const Line &Lines::at(const size_t aIndex) const
+{
+    return Find(aIndex)->mLine;
+}
+
+Lines::iterator Lines::IteratorAt(const size_t aIndex)
+{
+    return {this, aIndex < size() ? Find(aIndex) : nullptr};
+}
+
+Lines::const_iterator Lines::IteratorAt(const size_t aIndex) const
+{
+    return {this, aIndex < size() ? Find(aIndex) : nullptr};
+}
+
+Line &Lines::insert(const size_t aIndex, Line aLine)
+{
+    assert(aIndex <= size());
+
+    Node *node = new Node(std::move(aLine));
+    Node *left = nullptr;
+    Node *right = nullptr;
+    Split(mRoot, aIndex, left, right);
+    mRoot = Merge(Merge(left, node), right);
+    mRoot->mParent = nullptr;
+    return node->mLine;
+}
+
+void Lines::insert(const size_t aIndex, std::vector<Line> &&aLines)
+{
+    assert(aIndex <= size());
+
+    if (aLines.empty())
+    {
+        return;
+    }
+
+    Node *left = nullptr;
+    Node *right = nullptr;
+    Split(mRoot, aIndex, left, right);
+    mRoot = Merge(Merge(left, Build(aLines, 0, aLines.size())), right);
+    mRoot->mParent = nullptr;
+    aLines.clear();
+}
+
+void Lines::erase(const size_t aFirst, const size_t aLast)
+{
+    assert(aFirst <= aLast && aLast <= size());
+
+    if (aFirst == aLast)
+    {
+        return;
+    }
+
+    Node *left = nullptr;
+    Node *middle = nullptr;
+    Node *right = nullptr;
+    Split(mRoot, aFirst, left, middle);
+    Split(middle, aLast - aFirst, middle, right);
+    Destroy(middle);
+    mRoot = Merge(left, right);
+    if (mRoot != nullptr)
+    {
+        mRoot->mParent = nullptr;
+    }
+}
+
+void Lines::clear()
+{
+    Destroy(mRoot);
+    mRoot = nullptr;
+}
+
+void Lines::Update(Node *aNode)
+{
+    aNode->mSize = 1 + SizeOf(aNode->mLeft) + SizeOf(aNode->mRight);
+    aNode->mRowSum = aNode->mRows + RowSumOf(aNode->mLeft) + RowSumOf(aNode->mRight);
+    if (aNode->mLeft != nullptr)
+    {
+        aNode->mLeft->mParent = aNode;
+    }
+    if (aNode->mRight != nullptr)
+    {
+        aNode->mRight->mParent = aNode;
+    }
+}
+
+Lines::Node *Lines::Leftmost(Node *aNode)
+{
+    if (aNode != nullptr)
+    {
+        while (aNode->mLeft != nullptr)
+        {
+            aNode = aNode->mLeft;
+        }
+    }
+    return aNode;
+}
+
+Lines::Node *Lines::Rightmost(Node *aNode)
+{
+    if (aNode != nullptr)
+    {
+        while (aNode->mRight != nullptr)
+        {
+            aNode = aNode->mRight;
+        }
+    }
+    return aNode;
+}
+
+Lines::Node *Lines::Next(Node *aNode)
+{
+    if (aNode->mRight != nullptr)
+    {
+        return Leftmost(aNode->mRight);
+    }
+    while (aNode->mParent != nullptr && aNode->mParent->mRight == aNode)
+    {
+        aNode = aNode->mParent;
+    }
+    return aNode->mParent;
+}
+
+Lines::Node *Lines::Prev(Node *aNode)
+{
+    if (aNode->mLeft != nullptr)
+    {
+        return Rightmost(aNode->mLeft);
+    }
+    while (aNode->mParent != nullptr && aNode->mParent->mLeft == aNode)
+    {
+        aNode = aNode->mParent;
+    }
+    return aNode->mParent;
+}
+
+void Lines::Destroy(Node *aNode)
+{
+    // Iterative, so that tearing down a large document cannot overflow the stack
+    std::vector<Node *> stack;
+    if (aNode != nullptr)
+    {
+        stack.push_back(aNode);
+    }
+    while (!stack.empty())
+    {
+        Node *node = stack.back();
+        stack.pop_back();
+        if (node->mLeft != nullptr)
+        {
+            stack.push_back(node->mLeft);
+        }
+        if (node->mRight != nullptr)
+        {
+            stack.push_back(node->mRight);
+        }
+        delete node;
+    }
+}
+
+Lines::Node *Lines::Clone(const Node *aNode)
+{
+    if (aNode == nullptr)
+    {
+        return nullptr;
+    }
+    Node *node = new Node(aNode->mLine);
+    node->mRows = aNode->mRows;
+    node->mLeft = Clone(aNode->mLeft);
+    node->mRight = Clone(aNode->mRight);
+    Update(node);
+    return node;
+}
+
+// Builds a perfectly balanced tree out of aLines[aFrom, aTo)
+Lines::Node *Lines::Build(std::vector<Line> &aLines, const size_t aFrom, const size_t aTo)
+{
+    if (aFrom == aTo)
+    {
+        return nullptr;
+    }
+    const size_t mid = aFrom + (aTo - aFrom) / 2;
+    Node *node = new Node(std::move(aLines.at(mid)));
+    node->mLeft = Build(aLines, aFrom, mid);
+    node->mRight = Build(aLines, mid + 1, aTo);
+    Update(node);
+    return node;
+}
+
+Lines::Node *Lines::Find(size_t aIndex) const
+{
+    assert(aIndex < size());
+
+    Node *node = mRoot;
+    for (;;)
+    {
+        const size_t leftSize = SizeOf(node->mLeft);
+        if (aIndex < leftSize)
+        {
+            node = node->mLeft;
+        } else if (aIndex == leftSize)
+        {
+            return node;
+        } else
+        {
+            aIndex -= leftSize + 1;
+            node = node->mRight;
+        }
+    }
+}
+
+void Lines::SetRows(const iterator &aLine, const uint32_t aRows)
+{
+    assert(aRows > 0);
+
+    Node *node = aLine.mNode;
+    if (node->mRows == aRows)
+    {
+        return;
+    }
+    node->mRows = aRows;
+    for (; node != nullptr; node = node->mParent)
+    {
+        node->mRowSum = node->mRows + RowSumOf(node->mLeft) + RowSumOf(node->mRight);
+    }
+}
+
+void Lines::ResetRows()
+{
+    std::vector<Node *> stack;
+    if (mRoot != nullptr)
+    {
+        stack.push_back(mRoot);
+    }
+    while (!stack.empty())
+    {
+        Node *node = stack.back();
+        stack.pop_back();
+        node->mRows = 1;
+        node->mRowSum = node->mSize;
+        if (node->mLeft != nullptr)
+        {
+            stack.push_back(node->mLeft);
+        }
+        if (node->mRight != nullptr)
+        {
+            stack.push_back(node->mRight);
+        }
+    }
+}
+
+size_t Lines::RowOf(size_t aIndex) const
+{
+    assert(aIndex <= size());
+
+    size_t rows = 0;
+    const Node *node = mRoot;
+    while (node != nullptr)
+    {
+        const size_t leftSize = SizeOf(node->mLeft);
+        if (aIndex <= leftSize)
+        {
+            node = node->mLeft;
+        } else
+        {
+            rows += RowSumOf(node->mLeft) + node->mRows;
+            aIndex -= leftSize + 1;
+            node = node->mRight;
+        }
+    }
+    return rows;
+}
+
+size_t Lines::LineAtRow(size_t aRow, size_t &aSubRow) const
+{
+    assert(!empty());
+
+    if (aRow >= rows())
+    {
+        aSubRow = aRow - RowOf(size() - 1);
+        return size() - 1;
+    }
+
+    size_t index = 0;
+    const Node *node = mRoot;
+    for (;;)
+    {
+        const size_t leftRows = RowSumOf(node->mLeft);
+        if (aRow < leftRows)
+        {
+            node = node->mLeft;
+        } else if (aRow < leftRows + node->mRows)
+        {
+            aSubRow = aRow - leftRows;
+            return index + SizeOf(node->mLeft);
+        } else
+        {
+            aRow -= leftRows + node->mRows;
+            index += SizeOf(node->mLeft) + 1;
+            node = node->mRight;
+        }
+    }
+}
+
+// Joins two trees, every line of aLeft ending up before every line of aRight.
+// The root is picked with a probability proportional to the subtree sizes, which keeps the
+// tree a random binary search tree and hence its expected depth logarithmic.
+Lines::Node *Lines::Merge(Node *aLeft, Node *aRight)
+{
+    if (aLeft == nullptr)
+    {
+        return aRight;
+    }
+    if (aRight == nullptr)
+    {
+        return aLeft;
+    }
+
+    if (Random() % (aLeft->mSize + aRight->mSize) < aLeft->mSize)
+    {
+        aLeft->mRight = Merge(aLeft->mRight, aRight);
+        Update(aLeft);
+        return aLeft;
+    }
+    aRight->mLeft = Merge(aLeft, aRight->mLeft);
+    Update(aRight);
+    return aRight;
+}
+
+// Splits a tree so that the first aCount lines go to aLeft and the rest to aRight.
+void Lines::Split(Node *aNode, const size_t aCount, Node *&aLeft, Node *&aRight)
+{
+    if (aNode == nullptr)
+    {
+        aLeft = aRight = nullptr;
+        return;
+    }
+
+    const size_t leftSize = SizeOf(aNode->mLeft);
+    if (aCount <= leftSize)
+    {
+        Split(aNode->mLeft, aCount, aLeft, aNode->mLeft);
+        Update(aNode);
+        aRight = aNode;
+    } else
+    {
+        Split(aNode->mRight, aCount - leftSize - 1, aNode->mRight, aRight);
+        Update(aNode);
+        aLeft = aNode;
+    }
+}
+
+uint64_t Lines::Random()
+{
+    // xorshift64*
+    mSeed ^= mSeed >> 12;
+    mSeed ^= mSeed << 25;
+    mSeed ^= mSeed >> 27;
+    return mSeed * 0x2545F4914F6CDD1Dull;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Line.h"
+
+// Document line storage.
+// Lines are kept in a randomized balanced binary tree keyed implicitly by their position, so
+// that looking up, inserting and removing a line costs O(log n) regardless of where in the
+// document it happens. The interface mirrors the subset of std::vector the editor relies on.
+//
+// Each line also has a number of screen rows, one unless word wrap sets it otherwise. The tree
+// sums them alongside the line counts, so that converting between lines and rows is O(log n) too.
+class Lines
+{
+    private:
+        struct Node
+        {
+                Line mLine;
+                Node *mLeft = nullptr;
+                Node *mRight = nullptr;
+                Node *mParent = nullptr;
+                size_t mSize = 1; // number of lines in this subtree
+                uint32_t mRows = 1; // screen rows of this line
+                size_t mRowSum = 1; // screen rows of this subtree
+
+                explicit Node(Line aLine): mLine(std::move(aLine)) {}
+        };
+
+    public:
+        template<bool IsConst>
+        class Iterator
+        {
+            public:
+                using iterator_category = std::bidirectional_iterator_tag;
+                using value_type = Line;
+                using difference_type = std::ptrdiff_t;
+                using pointer = std::conditional_t<IsConst, const Line *, Line *>;
+                using reference = std::conditional_t<IsConst, const Line &, Line &>;
+
+                Iterator() = default;
+
+                reference operator*() const
+                {
+                    return mNode->mLine;
+                }
+                pointer operator->() const
+                {
+                    return &mNode->mLine;
+                }
+
+                Iterator &operator++()
+                {
+                    mNode = Next(mNode);
+                    return *this;
+                }
+                Iterator operator++(int)
+                {
+                    Iterator tmp = *this;
+                    ++*this;
+                    return tmp;
+                }
+                Iterator &operator--()
+                {
+                    mNode = mNode != nullptr ? Prev(mNode) : Rightmost(mOwner->mRoot);
+                    return *this;
+                }
+                Iterator operator--(int)
+                {
+                    Iterator tmp = *this;
+                    --*this;
+                    return tmp;
+                }
+
+                bool operator==(const Iterator &o) const
+                {
+                    return mNode == o.mNode;
+                }
+                bool operator!=(const Iterator &o) const
+                {
+                    return mNode != o.mNode;
+                }
+
+            private:
+                friend class Lines;
+                using OwnerPtr = std::conditional_t<IsConst, const Lines *, Lines *>;
+
+                Iterator(OwnerPtr aOwner, Node *aNode): mOwner(aOwner), mNode(aNode) {}
+
+                OwnerPtr mOwner = nullptr;
+                Node *mNode = nullptr;
+        };
+
+        using iterator = Iterator<false>;
+        using const_iterator = Iterator<true>;
+
+        Lines() = default;
+        ~Lines();
+        Lines(const Lines &aOther);
+        Lines(Lines &&aOther) noexcept;
+        Lines &operator=(const Lines &aOther);
+        Lines &operator=(Lines &&aOther) noexcept;
+
+        size_t size() const
+        {
+            return mRoot != nullptr ? mRoot->mSize : 0;
+        }
+        bool empty() const
+        {
+            return mRoot == nullptr;
+        }
+
+        Line &at(size_t aIndex);
+        const Line &at(size_t aIndex) const;
+        Line &operator[](const size_t aIndex)
+        {
+            return at(aIndex);
+        }
+        const Line &operator[](const size_t aIndex) const
+        {
+            return at(aIndex);
+        }
+        Line &back()
+        {
+            assert(!empty());
+            return Rightmost(mRoot)->mLine;
+        }
+        const Line &back() const
+        {
+            assert(!empty());
+            return Rightmost(mRoot)->mLine;
+        }
+
+        iterator begin()
+        {
+            return {this, Leftmost(mRoot)};
+        }
+        iterator end()
+        {
+            return {this, nullptr};
+        }
+        const_iterator begin() const
+        {
+            return {this, Leftmost(mRoot)};
+        }
+        const_iterator end() const
+        {
+            return {this, nullptr};
+        }
+        // Iterator to the line at aIndex, in O(log n).
+        iterator IteratorAt(size_t aIndex);
+        const_iterator IteratorAt(size_t aIndex) const;
+
+        // Inserts a line before aIndex (aIndex == size() appends) and returns it.
+        Line &insert(size_t aIndex, Line aLine = Line());
+        // Splices a run of lines in before aIndex, in O(k + log n) for k lines.
+        void insert(size_t aIndex, std::vector<Line> &&aLines);
+        // Removes the lines in [aFirst, aLast).
+        void erase(size_t aFirst, size_t aLast);
+        void erase(const size_t aIndex)
+        {
+            erase(aIndex, aIndex + 1);
+        }
+        Line &emplace_back()
+        {
+            return insert(size());
+        }
+        void clear();
+
+        // The number of screen rows of all lines.
+        size_t rows() const
+        {
+            return mRoot != nullptr ? mRoot->mRowSum : 0;
+        }
+        template<bool IsConst>
+        uint32_t GetRows(const Iterator<IsConst> &aLine) const
+        {
+            return aLine.mNode->mRows;
+        }
+        void SetRows(const iterator &aLine, uint32_t aRows);
+        // Sets every line to one row.
+        void ResetRows();
+        // The number of screen rows of the lines before aIndex.
+        size_t RowOf(size_t aIndex) const;
+        // The line screen row aRow belongs to, and the row within that line. Rows past the end belong
+        // to the last line.
+        size_t LineAtRow(size_t aRow, size_t &aSubRow) const;
+
+    private:
+        static size_t SizeOf(const Node *aNode)
+        {
+            return aNode != nullptr ? aNode->mSize : 0;
+        }
+        static size_t RowSumOf(const Node *aNode)
+        {
+            return aNode != nullptr ? aNode->mRowSum : 0;
+        }
+        static void Update(Node *aNode);
+        static Node *Leftmost(Node *aNode);
+        static Node *Rightmost(Node *aNode);
+        static Node *Next(Node *aNode);
+        static Node *Prev(Node *aNode);
+        static void Destroy(Node *aNode);
+        static Node *Clone(const Node *aNode);
+        static Node *Build(std::vector<Line> &aLines, size_t aFrom, size_t aTo);
+
+        Node *Find(size_t aIndex) const;
+        Node *Merge(Node *aLeft, Node *aRight);
+        void Split(Node *aNode, size_t aCount, Node *&aLeft, Node *&aRight);
+        uint64_t Random();
+
+        Node *mRoot = nullptr;
+        uint64_t mSeed = 0x9E3779B97F4A7C15ull;
+};
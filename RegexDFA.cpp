@@ -0,0 +1,719 @@
+#include "RegexDFA.h"
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Line.h"
+#include "Palette.h"
+#include "Types.h"
+
+namespace
+{
+    // Upper bound on the number of DFA states; languages exceeding it keep using std::regex
+    constexpr size_t kMaxStates = 4096;
+    constexpr int kUnbounded = -1;
+
+    using ByteSet = std::bitset<256>;
+
+    struct RegexNode
+    {
+            enum class Kind : uint8_t
+            {
+                Set,
+                Concat,
+                Alternate,
+                Repeat
+            };
+
+            Kind mKind = Kind::Set;
+            ByteSet mSet;
+            std::vector<std::unique_ptr<RegexNode>> mChildren;
+            int mMin = 0;
+            int mMax = 0;
+    };
+
+    using NodePtr = std::unique_ptr<RegexNode>;
+
+    // Recursive descent parser for the supported ECMAScript subset
+    class RegexParser
+    {
+        public:
+            explicit RegexParser(const std::string &aPattern): mPos(aPattern.data()), mEnd(aPattern.data() + aPattern.size())
+            {}
+
+            NodePtr Parse()
+            {
+                NodePtr node = ParseAlternate();
+                if (node == nullptr || mPos != mEnd)
+                {
+                    return nullptr;
+                }
+                return node;
+            }
+
+        private:
+            NodePtr ParseAlternate()
+            {
+                NodePtr first = ParseConcat();
+                if (first == nullptr || mPos == mEnd || *mPos != '|')
+                {
+                    return first;
+                }
+
+                NodePtr node = std::make_unique<RegexNode>();
+                node->mKind = RegexNode::Kind::Alternate;
+                node->mChildren.push_back(std::move(first));
+                while (mPos != mEnd && *mPos == '|')
+                {
+                    ++mPos;
+                    NodePtr next = ParseConcat();
+                    if (next == nullptr)
+                    {
+                        return nullptr;
+                    }
+                    node->mChildren.push_back(std::move(next));
+                }
+                return node;
+            }
+
+            NodePtr ParseConcat()
+            {
+                NodePtr node = std::make_unique<RegexNode>();
+                node->mKind = RegexNode::Kind::Concat;
+                while (mPos != mEnd && *mPos != '|' && *mPos != ')')
+                {
+                    NodePtr atom = ParseQuantified();
+                    if (atom == nullptr)
+                    {
+                        return nullptr;
+                    }
+                    node->mChildren.push_back(std::move(atom));
+                }
+                return node;
+            }
+
+            NodePtr ParseQuantified()
+            {
+                NodePtr atom = ParseAtom();
+                while (atom != nullptr && mPos != mEnd)
+                {
+                    int min = 0;
+                    int max = 0;
+                    if (*mPos == '*')
+                    {
+                        min = 0;
+                        max = kUnbounded;
+                        ++mPos;
+                    } else if (*mPos == '+')
+                    {
+                        min = 1;
+                        max = kUnbounded;
+                        ++mPos;
+                    } else if (*mPos == '?')
+                    {
+                        min = 0;
+                        max = 1;
+                        ++mPos;
+                    } else if (*mPos == '{')
+                    {
+                        if (!ParseBraces(min, max))
+                        {
+                            return nullptr;
+                        }
+                    } else
+                    {
+                        break;
+                    }
+
+                    // Lazy quantifiers have no meaning for a longest-match automaton
+                    if (mPos != mEnd && *mPos == '?')
+                    {
+                        return nullptr;
+                    }
+
+                    NodePtr repeat = std::make_unique<RegexNode>();
+                    repeat->mKind = RegexNode::Kind::Repeat;
+                    repeat->mMin = min;
+                    repeat->mMax = max;
+                    repeat->mChildren.push_back(std::move(atom));
+                    atom = std::move(repeat);
+                }
+                return atom;
+            }
+
+            bool ParseBraces(int &aMin, int &aMax)
+            {
+                ++mPos;
+                if (!ParseNumber(aMin))
+                {
+                    return false;
+                }
+                aMax = aMin;
+                if (mPos != mEnd && *mPos == ',')
+                {
+                    ++mPos;
+                    aMax = kUnbounded;
+                    if (mPos != mEnd && *mPos != '}' && !ParseNumber(aMax))
+                    {
+                        return false;
+                    }
+                }
+                if (mPos == mEnd || *mPos != '}' || (aMax != kUnbounded && aMax < aMin))
+                {
+                    return false;
+                }
+                ++mPos;
+                return true;
+            }
+
+            bool ParseNumber(int &aOut)
+            {
+                const char *start = mPos;
+                aOut = 0;
+                while (mPos != mEnd && *mPos >= '0' && *mPos <= '9' && aOut < 1000)
+                {
+                    aOut = aOut * 10 + (*mPos - '0');
+                    ++mPos;
+                }
+                // Large counts would blow up the automaton anyway
+                return mPos != start && aOut < 256;
+            }
+
+            NodePtr ParseAtom()
+            {
+                if (mPos == mEnd)
+                {
+                    return nullptr;
+                }
+
+                const char c = *mPos++;
+                if (c == '(')
+                {
+                    if (mPos != mEnd && *mPos == '?')
+                    {
+                        if (mEnd - mPos < 2 || mPos[1] != ':')
+                        {
+                            return nullptr; // lookahead
+                        }
+                        mPos += 2;
+                    }
+                    NodePtr node = ParseAlternate();
+                    if (node == nullptr || mPos == mEnd || *mPos != ')')
+                    {
+                        return nullptr;
+                    }
+                    ++mPos;
+                    return node;
+                }
+
+                NodePtr node = std::make_unique<RegexNode>();
+                switch (c)
+                {
+                    case '[':
+                        if (!ParseBracket(node->mSet))
+                        {
+                            return nullptr;
+                        }
+                        break;
+                    case '.':
+                        node->mSet.set();
+                        node->mSet.reset('\n');
+                        node->mSet.reset('\r');
+                        break;
+                    case '\\':
+                        if (!ParseEscape(node->mSet, false))
+                        {
+                            return nullptr;
+                        }
+                        break;
+                    case '^':
+                    case '$':
+                    case '*':
+                    case '+':
+                    case '?':
+                    case '{':
+                    case ')':
+                        return nullptr;
+                    default:
+                        node->mSet.set(static_cast<uint8_t>(c));
+                        break;
+                }
+                return node;
+            }
+
+            // Parses the bracket expression following '['
+            bool ParseBracket(ByteSet &aSet)
+            {
+                bool negate = false;
+                if (mPos != mEnd && *mPos == '^')
+                {
+                    negate = true;
+                    ++mPos;
+                }
+
+                // ECMAScript reads "[]" as a class that matches nothing and "[^]" as one that matches
+                // anything, not as a literal ']'; those rules are left to std::regex
+                if (mPos != mEnd && *mPos == ']')
+                {
+                    return false;
+                }
+
+                while (mPos != mEnd && *mPos != ']')
+                {
+                    ByteSet item;
+                    int low = -1;
+                    if (!ParseBracketItem(item, low))
+                    {
+                        return false;
+                    }
+
+                    if (low >= 0 && mEnd - mPos >= 2 && *mPos == '-' && mPos[1] != ']')
+                    {
+                        ++mPos;
+                        ByteSet highItem;
+                        int high = -1;
+                        if (!ParseBracketItem(highItem, high) || high < low)
+                        {
+                            return false;
+                        }
+                        for (int b = low; b <= high; ++b)
+                        {
+                            aSet.set(b);
+                        }
+                    } else
+                    {
+                        aSet |= item;
+                    }
+                }
+
+                if (mPos == mEnd)
+                {
+                    return false;
+                }
+                ++mPos;
+
+                if (negate)
+                {
+                    aSet.flip();
+                }
+                return true;
+            }
+
+            // A single bracket element; aByte receives its value when it is a single byte usable as a range bound
+            bool ParseBracketItem(ByteSet &aSet, int &aByte)
+            {
+                const char c = *mPos++;
+                if (c == '\\')
+                {
+                    if (!ParseEscape(aSet, true))
+                    {
+                        return false;
+                    }
+                    if (aSet.count() == 1)
+                    {
+                        for (int b = 0; b < 256; ++b)
+                        {
+                            if (aSet.test(b))
+                            {
+                                aByte = b;
+                            }
+                        }
+                    }
+                    return true;
+                }
+                if (c == '[' && mPos != mEnd && (*mPos == ':' || *mPos == '=' || *mPos == '.'))
+                {
+                    return false; // POSIX classes
+                }
+                aByte = static_cast<uint8_t>(c);
+                aSet.set(aByte);
+                return true;
+            }
+
+            // Parses the escape following '\'
+            bool ParseEscape(ByteSet &aSet, const bool aInBracket)
+            {
+                if (mPos == mEnd)
+                {
+                    return false;
+                }
+
+                const char c = *mPos++;
+                switch (c)
+                {
+                    case 'd':
+                    case 'D':
+                        for (int b = '0'; b <= '9'; ++b)
+                        {
+                            aSet.set(b);
+                        }
+                        break;
+                    case 'w':
+                    case 'W':
+                        for (int b = 0; b < 256; ++b)
+                        {
+                            if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || b == '_')
+                            {
+                                aSet.set(b);
+                            }
+                        }
+                        break;
+                    case 's':
+                    case 'S':
+                        for (const char s: {' ', '\t', '\n', '\r', '\f', '\v'})
+                        {
+                            aSet.set(static_cast<uint8_t>(s));
+                        }
+                        break;
+                    case 't':
+                        aSet.set('\t');
+                        return true;
+                    case 'n':
+                        aSet.set('\n');
+                        return true;
+                    case 'r':
+                        aSet.set('\r');
+                        return true;
+                    case 'f':
+                        aSet.set('\f');
+                        return true;
+                    case 'v':
+                        aSet.set('\v');
+                        return true;
+                    case '0':
+                        aSet.set(0);
+                        return true;
+                    case 'x':
+                    {
+                        int value = 0;
+                        for (int i = 0; i < 2; ++i)
+                        {
+                            if (mPos == mEnd)
+                            {
+                                return false;
+                            }
+                            const char h = *mPos++;
+                            int digit;
+                            if (h >= '0' && h <= '9')
+                            {
+                                digit = h - '0';
+                            } else if (h >= 'a' && h <= 'f')
+                            {
+                                digit = h - 'a' + 10;
+                            } else if (h >= 'A' && h <= 'F')
+                            {
+                                digit = h - 'A' + 10;
+                            } else
+                            {
+                                return false;
+                            }
+                            value = value * 16 + digit;
+                        }
+                        aSet.set(value);
+                        return true;
+                    }
+                    case 'b':
+                        if (!aInBracket)
+                        {
+                            return false; // word boundary
+                        }
+                        aSet.set('\b');
+                        return true;
+                    default:
+                        // Back-references and the remaining letter escapes are not supported
+                        if ((c >= '1' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+                        {
+                            return false;
+                        }
+                        aSet.set(static_cast<uint8_t>(c));
+                        return true;
+                }
+
+                if (c == 'D' || c == 'W' || c == 'S')
+                {
+                    aSet.flip();
+                }
+                return true;
+            }
+
+            const char *mPos;
+            const char *mEnd;
+    };
+
+    // Thompson construction of the union of all rules
+    class Nfa
+    {
+        public:
+            struct State
+            {
+                    std::vector<int> mEpsilon;
+                    ByteSet mSet;
+                    int mNext = -1; // target of the mSet transition
+                    int mAccept = -1; // rule index
+            };
+
+            int AddState()
+            {
+                mStates.emplace_back();
+                return static_cast<int>(mStates.size()) - 1;
+            }
+
+            // Emits aNode between two new states, returned as (start, end)
+            std::pair<int, int> Emit(const RegexNode &aNode)
+            {
+                switch (aNode.mKind)
+                {
+                    case RegexNode::Kind::Set:
+                    {
+                        const int start = AddState();
+                        const int end = AddState();
+                        mStates[start].mSet = aNode.mSet;
+                        mStates[start].mNext = end;
+                        return {start, end};
+                    }
+                    case RegexNode::Kind::Concat:
+                    {
+                        const int start = AddState();
+                        int end = start;
+                        for (const NodePtr &child: aNode.mChildren)
+                        {
+                            const std::pair<int, int> part = Emit(*child);
+                            mStates[end].mEpsilon.push_back(part.first);
+                            end = part.second;
+                        }
+                        return {start, end};
+                    }
+                    case RegexNode::Kind::Alternate:
+                    {
+                        const int start = AddState();
+                        const int end = AddState();
+                        for (const NodePtr &child: aNode.mChildren)
+                        {
+                            const std::pair<int, int> part = Emit(*child);
+                            mStates[start].mEpsilon.push_back(part.first);
+                            mStates[part.second].mEpsilon.push_back(end);
+                        }
+                        return {start, end};
+                    }
+                    case RegexNode::Kind::Repeat:
+                    {
+                        const RegexNode &child = *aNode.mChildren.front();
+                        const int start = AddState();
+                        int end = start;
+                        for (int i = 0; i < aNode.mMin; ++i)
+                        {
+                            const std::pair<int, int> part = Emit(child);
+                            mStates[end].mEpsilon.push_back(part.first);
+                            end = part.second;
+                        }
+                        if (aNode.mMax == kUnbounded)
+                        {
+                            const std::pair<int, int> part = Emit(child);
+                            const int exit = AddState();
+                            mStates[end].mEpsilon.push_back(part.first);
+                            mStates[end].mEpsilon.push_back(exit);
+                            mStates[part.second].mEpsilon.push_back(end);
+                            end = exit;
+                        } else
+                        {
+                            const int exit = AddState();
+                            for (int i = aNode.mMin; i < aNode.mMax; ++i)
+                            {
+                                const std::pair<int, int> part = Emit(child);
+                                mStates[end].mEpsilon.push_back(part.first);
+                                mStates[end].mEpsilon.push_back(exit);
+                                end = part.second;
+                            }
+                            mStates[end].mEpsilon.push_back(exit);
+                            end = exit;
+                        }
+                        return {start, end};
+                    }
+                }
+                return {-1, -1};
+            }
+
+            // Replaces aSet by its epsilon closure, sorted
+            void Close(std::vector<int> &aSet, std::vector<uint8_t> &aVisited) const
+            {
+                std::ranges::fill(aVisited, 0);
+                std::vector<int> stack(aSet);
+                aSet.clear();
+                while (!stack.empty())
+                {
+                    const int s = stack.back();
+                    stack.pop_back();
+                    if (aVisited[s] != 0)
+                    {
+                        continue;
+                    }
+                    aVisited[s] = 1;
+                    aSet.push_back(s);
+                    for (const int e: mStates[s].mEpsilon)
+                    {
+                        stack.push_back(e);
+                    }
+                }
+                std::ranges::sort(aSet);
+            }
+
+            std::vector<State> mStates;
+    };
+} // namespace
+
+bool RegexDFA::Compile(const TokenRegexStrings &aRules)
+{
+    Clear();
+    if (aRules.empty())
+    {
+        return false;
+    }
+
+    Nfa nfa;
+    const int nfaStart = nfa.AddState();
+    for (size_t i = 0; i < aRules.size(); ++i)
+    {
+        const NodePtr root = RegexParser(aRules[i].first).Parse();
+        if (root == nullptr)
+        {
+            return false;
+        }
+        const std::pair<int, int> part = nfa.Emit(*root);
+        nfa.mStates[nfaStart].mEpsilon.push_back(part.first);
+        nfa.mStates[part.second].mAccept = static_cast<int>(i);
+        mRuleColors.push_back(aRules[i].second);
+    }
+
+    // Bytes that no transition tells apart share an input class
+    std::vector<std::string> signatures(256);
+    for (const Nfa::State &state: nfa.mStates)
+    {
+        if (state.mNext < 0)
+        {
+            continue;
+        }
+        for (int b = 0; b < 256; ++b)
+        {
+            signatures[b].push_back(state.mSet.test(b) ? '1' : '0');
+        }
+    }
+    std::map<std::string, int> classIds;
+    std::vector<int> representative;
+    for (int b = 0; b < 256; ++b)
+    {
+        const auto [it, inserted] = classIds.emplace(signatures[b], static_cast<int>(classIds.size()));
+        if (inserted)
+        {
+            representative.push_back(b);
+        }
+        mByteClass[b] = static_cast<uint8_t>(it->second);
+    }
+    mClassCount = static_cast<int>(representative.size());
+
+    // Subset construction
+    std::vector<uint8_t> visited(nfa.mStates.size());
+    std::map<std::vector<int>, int> dfaIds;
+    std::vector<std::vector<int>> dfaSets;
+
+    std::vector<int> startSet{nfaStart};
+    nfa.Close(startSet, visited);
+    dfaIds.emplace(startSet, 0);
+    dfaSets.push_back(std::move(startSet));
+
+    for (size_t current = 0; current < dfaSets.size(); ++current)
+    {
+        int accept = -1;
+        for (const int s: dfaSets[current])
+        {
+            const int rule = nfa.mStates[s].mAccept;
+            if (rule >= 0 && (accept < 0 || rule < accept))
+            {
+                accept = rule;
+            }
+        }
+        mAccept.push_back(accept);
+
+        for (int c = 0; c < mClassCount; ++c)
+        {
+            const int b = representative[c];
+            std::vector<int> next;
+            for (const int s: dfaSets[current])
+            {
+                const Nfa::State &state = nfa.mStates[s];
+                if (state.mNext >= 0 && state.mSet.test(b))
+                {
+                    next.push_back(state.mNext);
+                }
+            }
+
+            int target = kDeadState;
+            if (!next.empty())
+            {
+                nfa.Close(next, visited);
+                const auto [it, inserted] = dfaIds.emplace(next, static_cast<int>(dfaSets.size()));
+                if (inserted)
+                {
+                    if (dfaSets.size() >= kMaxStates)
+                    {
+                        Clear();
+                        return false;
+                    }
+                    dfaSets.push_back(std::move(next));
+                }
+                target = it->second;
+            }
+            mTransitions.push_back(target);
+        }
+    }
+
+    return true;
+}
+
+void RegexDFA::Clear()
+{
+    mByteClass.fill(0);
+    mClassCount = 0;
+    mTransitions.clear();
+    mAccept.clear();
+    mRuleColors.clear();
+}
+
+template<typename CharIterator>
+bool RegexDFA::Match(const CharIterator aBegin, const CharIterator aEnd, CharIterator &aTokenEnd, PaletteIndex &aColor) const
+{
+    assert(IsValid());
+
+    // Empty matches are never reported, so the accept flag of the start state is irrelevant
+    int state = 0;
+    int rule = -1;
+    for (CharIterator p = aBegin; p != aEnd;)
+    {
+        state = mTransitions[static_cast<size_t>(state) * mClassCount + mByteClass[static_cast<uint8_t>(*p)]];
+        if (state == kDeadState)
+        {
+            break;
+        }
+        ++p;
+        if (mAccept[state] >= 0)
+        {
+            rule = mAccept[state];
+            aTokenEnd = p;
+        }
+    }
+
+    if (rule < 0)
+    {
+        return false;
+    }
+    aColor = mRuleColors[rule];
+    return true;
+}
+
+template bool RegexDFA::Match(const char *, const char *, const char *&, PaletteIndex &) const;
+template bool RegexDFA::Match(Line::CharIterator, Line::CharIterator, Line::CharIterator &, PaletteIndex &) const;
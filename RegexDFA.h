@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Palette.h"
+#include "Types.h"
+
+// The token regular expressions of a language definition, compiled into a single deterministic
+// automaton over bytes.
+// Matching runs the automaton once from the token start and reports the longest match; when
+// several rules match the same length the one listed first wins.
+// Supported syntax (ECMAScript subset): literals, escapes (\t \n \r \f \v \0 \xHH \d \D \w \W
+// \s \S and escaped punctuation), '.', bracket expressions with ranges and negation, groups
+// ('(...)' and '(?:...)'), alternation and the greedy quantifiers * + ? {n} {n,} {n,m}.
+// Compile() fails on anything else (anchors, back-references, lazy quantifiers, ...), in
+// which case the caller has to fall back to std::regex.
+class RegexDFA
+{
+    public:
+        RegexDFA() = default;
+
+        bool Compile(const TokenRegexStrings &aRules);
+        void Clear();
+        bool IsValid() const
+        {
+            return !mAccept.empty();
+        }
+
+        // Matches a token starting at aBegin. Returns false if no rule matches a non-empty prefix.
+        // Instantiated for char pointers and Line::CharIterator.
+        template<typename CharIterator>
+        bool Match(CharIterator aBegin, CharIterator aEnd, CharIterator &aTokenEnd, PaletteIndex &aColor) const;
+
+    private:
+        static constexpr int kDeadState = -1;
+
+        std::array<uint8_t, 256> mByteClass{};
+        int mClassCount = 0;
+        std::vector<int> mTransitions; // [state * mClassCount + class] -> state, or kDeadState
+        std::vector<int> mAccept; // per state, index of the rule matched on reaching it, or -1
+        std::vector<PaletteIndex> mRuleColors;
+};
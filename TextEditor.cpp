@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cctype>
 #include <cfloat>
+#include <charconv>
 #include <chrono>
 #include <cmath>
 #include <cstddef>
@@ -12,20 +13,55 @@
 #include <cstring>
 #include <limits>
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#include "ColorizerThread.h"
+#include "GlyphAdvances.h"
 #include "imgui.h"
 #include "imgui_internal.h" // sadly seems to be needed for PlatformImeData
 #include "LanguageDefinition.h"
+#include "Lines.h"
 #include "Palette.h"
 #include "Types.h"
 
 // TODO
 // - multiline comments vs single-line: latter is blocking start of a ML
 
+// Documents taller than this many pixels are scrolled virtually, as float scroll positions lose
+// precision beyond it
+static constexpr double kMaxScrollHeight = 1 << 21;
+
+// Time in microseconds Render() spends per frame wrapping or measuring lines that are not on screen
+static constexpr int kLayoutTimeBudget = 1000;
+
+// Lines a background comment scan copies past the lines queued for it, doubled while the scan keeps
+// running off the end of its copy
+static constexpr int kColorizeLookahead = 64;
+
+// Minimap: the most lines a tile holds, the size of a line's row and of a column in pixels, the columns of each
+// line shown and the space around them
+static constexpr int kMinimapTileLines = 64;
+static constexpr float kMinimapRowHeight = 2.0f;
+static constexpr float kMinimapColumnWidth = 1.0f;
+static constexpr int kMinimapColumns = 100;
+static constexpr float kMinimapPadding = 4.0f;
+// A line has a block per column at most, and the vertices of a tile are indexed with ImDrawIdx
+static_assert(kMinimapTileLines * kMinimapColumns * 4 <= 0x10000);
+
+// Length of a cursor blink, shown and hidden, in milliseconds
+static constexpr uint64_t kBlinkPeriod = 800;
+
+static uint64_t NowMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count();
+}
+
 template<class InputIt1, class InputIt2, class BinaryPredicate>
 static bool equals(InputIt1 first1, InputIt1 last1, InputIt2 first2, InputIt2 last2, BinaryPredicate p)
 {
@@ -50,20 +86,45 @@ TextEditor::TextEditor():
     mScrollToTop(false),
     mTextChanged(false),
     mColorizerEnabled(true),
+    mColorizeThreadCount(1),
+    mColorizeTimeBudget(4000),
+    mColorizeInBackground(false),
+    mColorizeLookahead(kColorizeLookahead),
     mTextStart(20.0f),
     mLeftMargin(10),
     mCursorPositionChanged(false),
-    mColorRangeMin(0),
-    mColorRangeMax(0),
     mSelectionMode(SelectionMode::Normal),
     mHandleKeyboardInputs(true),
     mHandleMouseInputs(true),
     mIgnoreImGuiChild(false),
     mShowWhitespaces(true),
-    mCheckComments(true),
-    mStartTime(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now()
-                                                                             .time_since_epoch())
-                       .count()),
+    mMonospace(false),
+    mRetainedRendering(false),
+    mWordWrap(false),
+    mShowMinimap(false),
+    mPaletteAlpha(-1.0f),
+    mDocumentVersion(0),
+    mLayoutKey(1),
+    mGlyphAdvances(nullptr),
+    mGlyphGeneration(0),
+    mWidthKey(0),
+    mPreviousLongestWidth(0.0f),
+    mMeshKey(1),
+    mMeshClipX(0.0f),
+    mMeshClipWidth(0.0f),
+    mMeshLayoutKey(0),
+    mMarkersVersion(0),
+    mFrameChanged(true),
+    mWrapWidth(0.0f),
+    mWrapLayoutKey(0),
+    mWrapKey(1),
+    mVirtualScroll(false),
+    mTopLine(0),
+    mTopRow(0),
+    mTopOffset(0.0f),
+    mScrollY(0.0f),
+    mViewHeight(0.0f),
+    mStartTime(NowMilliseconds()),
     mLastClick(-1.0f)
 {
     SetPalette(GetDarkPalette());
@@ -71,14 +132,29 @@ TextEditor::TextEditor():
     mLines.emplace_back();
 }
 
+TextEditor::~TextEditor()
+{
+    // Stop the thread before anything it reads is destroyed
+    mColorizer.mThread.reset();
+}
+
 void TextEditor::SetLanguageDefinition(const LanguageDefinition &aLanguageDef)
 {
+    // The colorizer thread reads the language definition
+    if (mColorizer.mThread != nullptr)
+    {
+        mColorizer.mThread->Wait();
+    }
+
     mLanguageDefinition = aLanguageDef;
     mRegexList.clear();
 
-    for (const std::pair<std::string, PaletteIndex> &r: mLanguageDefinition.mTokenRegexStrings)
+    if (!mRegexDFA.Compile(mLanguageDefinition.mTokenRegexStrings))
     {
-        mRegexList.emplace_back(std::regex(r.first, std::regex_constants::optimize), r.second);
+        for (const std::pair<std::string, PaletteIndex> &r: mLanguageDefinition.mTokenRegexStrings)
+        {
+            mRegexList.emplace_back(std::regex(r.first, std::regex_constants::optimize), r.second);
+        }
     }
 
     Colorize();
@@ -87,6 +163,7 @@ void TextEditor::SetLanguageDefinition(const LanguageDefinition &aLanguageDef)
 void TextEditor::SetPalette(const Palette &aValue)
 {
     mPaletteBase = aValue;
+    mPaletteAlpha = -1.0f;
 }
 
 std::string TextEditor::GetText(const Coordinates &aStart, const Coordinates &aEnd) const
@@ -99,13 +176,15 @@ std::string TextEditor::GetText(const Coordinates &aStart, const Coordinates &aE
     const int iend = GetCharacterIndex(aEnd);
     size_t s = 0;
 
-    for (size_t i = lstart; std::cmp_less(i, lend); i++)
+    Lines::const_iterator sizeIt = mLines.IteratorAt(lstart);
+    for (size_t i = lstart; std::cmp_less(i, lend) && sizeIt != mLines.end(); i++, ++sizeIt)
     {
-        s += mLines.at(i).size();
+        s += sizeIt->size();
     }
 
     result.reserve(s + s / 8);
 
+    Lines::const_iterator lineIt = mLines.IteratorAt(lstart);
     while (istart < iend || lstart < lend)
     {
         if (lstart >= static_cast<int>(mLines.size()))
@@ -113,15 +192,18 @@ std::string TextEditor::GetText(const Coordinates &aStart, const Coordinates &aE
             break;
         }
 
-        const std::vector<Glyph> &line = mLines.at(lstart);
+        const Line &line = *lineIt;
         if (istart < static_cast<int>(line.size()))
         {
-            result += line.at(istart).mChar;
-            istart++;
+            // Copy the rest of the line, or up to the end position on the last line
+            const int to = lstart < lend ? static_cast<int>(line.size()) : std::min(iend, static_cast<int>(line.size()));
+            line.AppendChars(result, istart, to);
+            istart = to;
         } else
         {
             istart = 0;
             ++lstart;
+            ++lineIt;
             result += '\n';
         }
     }
@@ -134,18 +216,29 @@ Coordinates TextEditor::GetActualCursorCoordinates() const
     return SanitizeCoordinates(mState.mCursorPosition);
 }
 
+// The screen row of a wrapped line that byte aIndex is on, the rows after the first starting at aWraps
+static size_t FindRow(const std::vector<uint32_t> &aWraps, const size_t aIndex)
+{
+    return std::upper_bound(aWraps.begin(), aWraps.end(), aIndex) - aWraps.begin();
+}
+
 ImVec2 TextEditor::GetCursorScreenPosition() const
 {
     const Coordinates cursor_position = GetActualCursorCoordinates();
 
-    const ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
-    const ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x,
-                                             cursorScreenPos.y +
-                                                     static_cast<float>(cursor_position.mLine) * mCharAdvance.y);
+    const ImVec2 lineStartScreenPos = ImVec2(ImGui::GetCursorScreenPos().x, GetLineScreenY(cursor_position.mLine));
     const ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
-    const float cx = TextDistanceToLineStart(mState.mCursorPosition);
-    return {textScreenPos.x + cx, lineStartScreenPos.y};
+    float cx = TextDistanceToLineStart(mState.mCursorPosition);
+    float cy = lineStartScreenPos.y;
+    const std::vector<uint32_t> &wraps = GetLineWraps(cursor_position.mLine);
+    const size_t row = FindRow(wraps, GetCharacterIndex(cursor_position));
+    if (row > 0)
+    {
+        cx -= GetLineLayout(cursor_position.mLine).at(wraps.at(row - 1));
+        cy += static_cast<float>(row) * mCharAdvance.y;
+    }
+    return {textScreenPos.x + cx, cy};
 }
 
 Coordinates TextEditor::SanitizeCoordinates(const Coordinates &aValue) const
@@ -169,6 +262,11 @@ Coordinates TextEditor::SanitizeCoordinates(const Coordinates &aValue) const
     return {line, column};
 }
 
+static bool IsUTFSequence(const char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
 // https://en.wikipedia.org/wiki/UTF-8
 // We assume that the char is a standalone character (<128) or a leading byte of an UTF-8 code sequence (non-10xxxxxx code)
 static int UTF8CharLength(const Char c)
@@ -247,12 +345,12 @@ void TextEditor::Advance(Coordinates &aCoordinates) const
 {
     if (aCoordinates.mLine < static_cast<int>(mLines.size()))
     {
-        const std::vector<Glyph> &line = mLines.at(aCoordinates.mLine);
+        const Line &line = mLines.at(aCoordinates.mLine);
         int cindex = GetCharacterIndex(aCoordinates);
 
         if (cindex + 1 < static_cast<int>(line.size()))
         {
-            const int delta = UTF8CharLength(line.at(cindex).mChar);
+            const int delta = UTF8CharLength(line.GetChar(cindex));
             cindex = std::min(cindex + delta, static_cast<int>(line.size()) - 1);
         } else
         {
@@ -280,26 +378,26 @@ void TextEditor::DeleteRange(const Coordinates &aStart, const Coordinates &aEnd)
 
     if (aStart.mLine == aEnd.mLine)
     {
-        std::vector<Glyph> &line = mLines.at(aStart.mLine);
+        Line &line = mLines.at(aStart.mLine);
         const int n = GetLineMaxColumn(aStart.mLine);
         if (aEnd.mColumn >= n)
         {
-            line.erase(line.begin() + start, line.end());
+            line.erase(start, line.size());
         } else
         {
-            line.erase(line.begin() + start, line.begin() + end);
+            line.erase(start, end);
         }
     } else
     {
-        std::vector<Glyph> &firstLine = mLines.at(aStart.mLine);
-        std::vector<Glyph> &lastLine = mLines.at(aEnd.mLine);
+        Line &firstLine = mLines.at(aStart.mLine);
+        Line &lastLine = mLines.at(aEnd.mLine);
 
-        firstLine.erase(firstLine.begin() + start, firstLine.end());
-        lastLine.erase(lastLine.begin(), lastLine.begin() + end);
+        firstLine.erase(start, firstLine.size());
+        lastLine.erase(0, end);
 
         if (aStart.mLine < aEnd.mLine)
         {
-            firstLine.insert(firstLine.end(), lastLine.begin(), lastLine.end());
+            firstLine.append(lastLine);
         }
 
         if (aStart.mLine < aEnd.mLine)
@@ -308,54 +406,85 @@ void TextEditor::DeleteRange(const Coordinates &aStart, const Coordinates &aEnd)
         }
     }
 
+    InvalidateScan(aStart.mLine, aStart.mLine + 1);
     mTextChanged = true;
 }
 
+// Appends aValue[0, aLength) to aOut, dropping carriage returns
+static void AppendWithoutCR(std::string &aOut, const char *aValue, const size_t aLength)
+{
+    const char *end = aValue + aLength;
+    while (aValue < end)
+    {
+        const char *cr = static_cast<const char *>(memchr(aValue, '\r', end - aValue));
+        const char *to = cr != nullptr ? cr : end;
+        aOut.append(aValue, to);
+        aValue = cr != nullptr ? cr + 1 : end;
+    }
+}
+
 int TextEditor::InsertTextAt(Coordinates & /* inout */ aWhere, const char *aValue)
 {
     assert(!mReadOnly);
+    assert(!mLines.empty());
 
-    int cindex = GetCharacterIndex(aWhere);
-    int totalLines = 0;
-    while (*aValue != '\0')
+    const size_t length = strlen(aValue);
+    if (length == 0)
     {
-        assert(!mLines.empty());
+        return 0;
+    }
 
-        if (*aValue == '\r')
-        {
-            // skip
-            ++aValue;
-        } else if (*aValue == '\n')
+    // Split the input at line breaks in one pass (memchr is vectorized by the C library)
+    std::vector<std::string> segments;
+    const char *end = aValue + length;
+    for (const char *p = aValue;;)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        std::string &segment = segments.emplace_back();
+        AppendWithoutCR(segment, p, (nl != nullptr ? nl : end) - p);
+        if (nl == nullptr)
         {
-            if (cindex < static_cast<int>(mLines.at(aWhere.mLine).size()))
-            {
-                Line &newLine = InsertLine(aWhere.mLine + 1);
-                std::vector<Glyph> &line = mLines.at(aWhere.mLine);
-                newLine.insert(newLine.begin(), line.begin() + cindex, line.end());
-                line.erase(line.begin() + cindex, line.end());
-            } else
-            {
-                (void)InsertLine(aWhere.mLine + 1);
-            }
-            ++aWhere.mLine;
-            aWhere.mColumn = 0;
-            cindex = 0;
-            ++totalLines;
-            ++aValue;
-        } else
+            break;
+        }
+        p = nl + 1;
+    }
+
+    const int cindex = GetCharacterIndex(aWhere);
+    Line &line = mLines.at(aWhere.mLine);
+    const std::string &last = segments.back();
+    const int totalLines = static_cast<int>(segments.size()) - 1;
+
+    if (totalLines == 0)
+    {
+        line.insert(cindex, last.data(), last.size());
+    } else
+    {
+        // Build all new lines first, the last one taking over the tail of the current line,
+        // then splice them in with a single tree operation
+        std::vector<Line> newLines;
+        newLines.reserve(segments.size() - 1);
+        for (size_t i = 1; i < segments.size(); ++i)
         {
-            std::vector<Glyph> &line = mLines.at(aWhere.mLine);
-            int d = UTF8CharLength(*aValue);
-            while (d-- > 0 && *aValue != '\0')
-            {
-                line.insert(line.begin() + cindex++, Glyph(*aValue++, PaletteIndex::Default));
-            }
-            ++aWhere.mColumn;
+            newLines.emplace_back(std::move(segments.at(i)));
         }
+        newLines.back().append(line, cindex, line.size());
+        line.erase(cindex, line.size());
+        line.insert(cindex, segments.front().data(), segments.front().size());
+        InsertLines(aWhere.mLine + 1, std::move(newLines));
 
-        mTextChanged = true;
+        aWhere.mLine += totalLines;
+        aWhere.mColumn = 0;
+    }
+
+    // The column advances by one per UTF-8 sequence of the last inserted line
+    for (size_t i = 0; i < last.size(); i += UTF8CharLength(last.at(i)))
+    {
+        ++aWhere.mColumn;
     }
 
+    InvalidateScan(aWhere.mLine - totalLines, aWhere.mLine + 1);
+    mTextChanged = true;
+
     return totalLines;
 }
 
@@ -374,63 +503,76 @@ void TextEditor::AddUndo(const UndoRecord &aValue)
     ++mUndoIndex;
 }
 
+// The first byte of the glyph of aLayout that x lies in: 0 left of the line, the last glyph right of it.
+// Bytes of one glyph share its offset, so the glyph starts at the first of them.
+static size_t FindGlyph(const std::vector<float> &aLayout, const float x)
+{
+    // The first byte whose glyph starts right of x
+    const std::vector<float>::const_iterator next = std::upper_bound(aLayout.begin(), aLayout.end() - 1, x);
+    if (next == aLayout.begin())
+    {
+        return 0;
+    }
+    return std::lower_bound(aLayout.begin(), next, *(next - 1)) - aLayout.begin();
+}
+
 Coordinates TextEditor::ScreenPosToCoordinates(const ImVec2 &aPosition) const
 {
     const ImVec2 origin = ImGui::GetCursorScreenPos();
-    const ImVec2 local(aPosition.x - origin.x, aPosition.y - origin.y);
-
-    const int lineNo = std::max(0, static_cast<int>(floor(local.y / mCharAdvance.y)));
+    int row = 0;
+    const int lineNo = std::max(0, GetScreenYLine(aPosition.y, &row));
+    if (lineNo >= static_cast<int>(mLines.size()))
+    {
+        return SanitizeCoordinates(Coordinates(lineNo, 0));
+    }
+    return GetRowCoordinates(lineNo, row, aPosition.x - origin.x - mTextStart);
+}
 
-    int columnCoord = 0;
+// The position on screen row aRow of aLine nearest to aX, relative to the start of that row. Rows past
+// the last one map to the end of the line, and positions past the end of a row that continues on the
+// next one to its last glyph, so that they stay on that row.
+Coordinates TextEditor::GetRowCoordinates(const int aLine, const int aRow, const float aX) const
+{
+    const Line &line = mLines.at(aLine);
+    const std::vector<uint32_t> &wraps = GetLineWraps(aLine);
+    if (static_cast<size_t>(aRow) > wraps.size())
+    {
+        return {aLine, GetLineMaxColumn(aLine)};
+    }
 
-    if (lineNo >= 0 && lineNo < static_cast<int>(mLines.size()))
+    if (wraps.empty() && line.IsPrintableAscii() && IsOnGrid(line))
     {
-        const std::vector<Glyph> &line = mLines.at(lineNo);
+        // The column boundary nearest to x
+        const float column = std::floor(aX / mGlyphAdvances->Advance('#') + 0.5f);
+        return {aLine, static_cast<int>(std::clamp(column, 0.0f, static_cast<float>(line.size())))};
+    }
 
-        int columnIndex = 0;
-        float columnX = 0.0f;
+    const std::vector<float> &layout = GetLineLayout(aLine);
+    const size_t rowStart = aRow > 0 ? wraps.at(aRow - 1) : 0;
+    const size_t rowEnd = static_cast<size_t>(aRow) < wraps.size() ? wraps.at(aRow) : line.size();
+    const float x = aX + layout.at(rowStart);
 
-        while (static_cast<size_t>(columnIndex) < line.size())
+    // The glyph x lies in, or the one after it if x is past its middle
+    size_t index = std::max(rowStart, FindGlyph(layout, x));
+    if (index < line.size())
+    {
+        const size_t next = std::min(line.size(), index + UTF8CharLength(line.GetChar(index)));
+        if (x >= (layout.at(index) + layout.at(next)) * 0.5f)
         {
-            float columnWidth = 0.0f;
-
-            if (line.at(columnIndex).mChar == '\t')
-            {
-                const float spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ").x;
-                const float oldX = columnX;
-                const float newColumnX = (1.0f +
-                                          std::floor((1.0f + columnX) / (static_cast<float>(mTabSize) * spaceSize))) *
-                                         (static_cast<float>(mTabSize) * spaceSize);
-                columnWidth = newColumnX - oldX;
-                if (mTextStart + columnX + columnWidth * 0.5f > local.x)
-                {
-                    break;
-                }
-                columnX = newColumnX;
-                columnCoord = (columnCoord / mTabSize) * mTabSize + mTabSize;
-                columnIndex++;
-            } else
-            {
-                std::array<char, 7> buf{};
-                int d = UTF8CharLength(line.at(columnIndex).mChar);
-                int i = 0;
-                while (i < 6 && d-- > 0)
-                {
-                    buf.at(i++) = line.at(columnIndex++).mChar;
-                }
-                buf.at(i) = '\0';
-                columnWidth = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf.data()).x;
-                if (mTextStart + columnX + columnWidth * 0.5f > local.x)
-                {
-                    break;
-                }
-                columnX += columnWidth;
-                columnCoord++;
-            }
+            index = next;
+        }
+    }
+    if (rowEnd < line.size())
+    {
+        size_t last = rowEnd - 1;
+        while (last > rowStart && IsUTFSequence(line.GetChar(last)))
+        {
+            --last;
         }
+        index = std::min(index, last);
     }
 
-    return SanitizeCoordinates(Coordinates(lineNo, columnCoord));
+    return SanitizeCoordinates(Coordinates(aLine, GetCharacterColumn(aLine, static_cast<int>(index))));
 }
 
 Coordinates TextEditor::FindWordStart(const Coordinates &aFrom) const
@@ -441,7 +583,7 @@ Coordinates TextEditor::FindWordStart(const Coordinates &aFrom) const
         return at;
     }
 
-    const std::vector<Glyph> &line = mLines.at(at.mLine);
+    const Line &line = mLines.at(at.mLine);
     int cindex = GetCharacterIndex(at);
 
     if (cindex >= static_cast<int>(line.size()))
@@ -449,15 +591,15 @@ Coordinates TextEditor::FindWordStart(const Coordinates &aFrom) const
         return at;
     }
 
-    while (cindex > 0 && isspace(line.at(cindex).mChar) != 0)
+    while (cindex > 0 && isspace(line.GetChar(cindex)) != 0)
     {
         --cindex;
     }
 
-    const PaletteIndex cstart = line.at(cindex).mColorIndex;
+    const PaletteIndex cstart = line.GetColorIndex(cindex);
     while (cindex > 0)
     {
-        const Char c = line.at(cindex).mChar;
+        const Char c = line.GetChar(cindex);
         if ((c & 0xC0) != 0x80) // not UTF code sequence 10xxxxxx
         {
             if (c <= 32 && isspace(c) != 0)
@@ -465,7 +607,7 @@ Coordinates TextEditor::FindWordStart(const Coordinates &aFrom) const
                 cindex++;
                 break;
             }
-            if (cstart != static_cast<PaletteIndex>(line.at(static_cast<size_t>(cindex - 1)).mColorIndex))
+            if (cstart != static_cast<PaletteIndex>(line.GetColorIndex(static_cast<size_t>(cindex - 1))))
             {
                 break;
             }
@@ -483,7 +625,7 @@ Coordinates TextEditor::FindWordEnd(const Coordinates &aFrom) const
         return at;
     }
 
-    const std::vector<Glyph> &line = mLines.at(at.mLine);
+    const Line &line = mLines.at(at.mLine);
     int cindex = GetCharacterIndex(at);
 
     if (cindex >= static_cast<int>(line.size()))
@@ -491,13 +633,13 @@ Coordinates TextEditor::FindWordEnd(const Coordinates &aFrom) const
         return at;
     }
 
-    const bool prevspace = isspace(line.at(cindex).mChar) != 0;
-    const PaletteIndex cstart = static_cast<PaletteIndex>(line.at(cindex).mColorIndex);
+    const bool prevspace = isspace(line.GetChar(cindex)) != 0;
+    const PaletteIndex cstart = static_cast<PaletteIndex>(line.GetColorIndex(cindex));
     while (cindex < static_cast<int>(line.size()))
     {
-        const Char c = line.at(cindex).mChar;
+        const Char c = line.GetChar(cindex);
         const int d = UTF8CharLength(c);
-        if (cstart != static_cast<PaletteIndex>(line.at(cindex).mColorIndex))
+        if (cstart != static_cast<PaletteIndex>(line.GetColorIndex(cindex)))
         {
             break;
         }
@@ -506,7 +648,7 @@ Coordinates TextEditor::FindWordEnd(const Coordinates &aFrom) const
         {
             if (isspace(c) != 0)
             {
-                while (cindex < static_cast<int>(line.size()) && isspace(line.at(cindex).mChar) != 0)
+                while (cindex < static_cast<int>(line.size()) && isspace(line.GetChar(cindex)) != 0)
                 {
                     ++cindex;
                 }
@@ -532,8 +674,8 @@ Coordinates TextEditor::FindNextWord(const Coordinates &aFrom) const
     bool skip = false;
     if (cindex < static_cast<int>(mLines.at(at.mLine).size()))
     {
-        const std::vector<Glyph> &line = mLines.at(at.mLine);
-        isword = isalnum(line.at(cindex).mChar) != 0;
+        const Line &line = mLines.at(at.mLine);
+        isword = isalnum(line.GetChar(cindex)) != 0;
         skip = isword;
     }
 
@@ -545,10 +687,10 @@ Coordinates TextEditor::FindNextWord(const Coordinates &aFrom) const
             return {l, GetLineMaxColumn(l)};
         }
 
-        const std::vector<Glyph> &line = mLines.at(at.mLine);
+        const Line &line = mLines.at(at.mLine);
         if (cindex < static_cast<int>(line.size()))
         {
-            isword = isalnum(line.at(cindex).mChar) != 0;
+            isword = isalnum(line.GetChar(cindex)) != 0;
 
             if (isword && !skip)
             {
@@ -579,19 +721,23 @@ int TextEditor::GetCharacterIndex(const Coordinates &aCoordinates) const
     {
         return -1;
     }
-    const std::vector<Glyph> &line = mLines.at(aCoordinates.mLine);
+    const Line &line = mLines.at(aCoordinates.mLine);
+    if (line.IsPrintableAscii())
+    {
+        return std::clamp(aCoordinates.mColumn, 0, static_cast<int>(line.size()));
+    }
     int c = 0;
     int i = 0;
     while (static_cast<size_t>(i) < line.size() && c < aCoordinates.mColumn)
     {
-        if (line.at(i).mChar == '\t')
+        if (line.GetChar(i) == '\t')
         {
             c = (c / mTabSize) * mTabSize + mTabSize;
         } else
         {
             ++c;
         }
-        i += UTF8CharLength(line.at(i).mChar);
+        i += UTF8CharLength(line.GetChar(i));
     }
     return i;
 }
@@ -602,12 +748,16 @@ int TextEditor::GetCharacterColumn(const int aLine, const int aIndex) const
     {
         return 0;
     }
-    const std::vector<Glyph> &line = mLines.at(aLine);
+    const Line &line = mLines.at(aLine);
+    if (line.IsPrintableAscii())
+    {
+        return std::clamp(aIndex, 0, static_cast<int>(line.size()));
+    }
     int col = 0;
     int i = 0;
     while (i < aIndex && i < static_cast<int>(line.size()))
     {
-        const Char c = line.at(i).mChar;
+        const Char c = line.GetChar(i);
         i += UTF8CharLength(c);
         if (c == '\t')
         {
@@ -626,11 +776,15 @@ int TextEditor::GetLineCharacterCount(const int aLine) const
     {
         return 0;
     }
-    const std::vector<Glyph> &line = mLines.at(aLine);
+    const Line &line = mLines.at(aLine);
+    if (line.IsPrintableAscii())
+    {
+        return static_cast<int>(line.size());
+    }
     int c = 0;
     for (unsigned i = 0; i < line.size(); c++)
     {
-        i += UTF8CharLength(line.at(i).mChar);
+        i += UTF8CharLength(line.GetChar(i));
     }
     return c;
 }
@@ -641,11 +795,15 @@ int TextEditor::GetLineMaxColumn(const int aLine) const
     {
         return 0;
     }
-    const std::vector<Glyph> &line = mLines.at(aLine);
+    const Line &line = mLines.at(aLine);
+    if (line.IsPrintableAscii())
+    {
+        return static_cast<int>(line.size());
+    }
     int col = 0;
     for (unsigned i = 0; i < line.size();)
     {
-        const Char c = line.at(i).mChar;
+        const Char c = line.GetChar(i);
         if (c == '\t')
         {
             col = (col / mTabSize) * mTabSize + mTabSize;
@@ -665,7 +823,7 @@ bool TextEditor::IsOnWordBoundary(const Coordinates &aAt) const
         return true;
     }
 
-    const std::vector<Glyph> &line = mLines.at(aAt.mLine);
+    const Line &line = mLines.at(aAt.mLine);
     const int cindex = GetCharacterIndex(aAt);
     if (cindex >= static_cast<int>(line.size()))
     {
@@ -674,10 +832,10 @@ bool TextEditor::IsOnWordBoundary(const Coordinates &aAt) const
 
     if (mColorizerEnabled)
     {
-        return line.at(cindex).mColorIndex != line.at(static_cast<size_t>(cindex - 1)).mColorIndex;
+        return line.GetColorIndex(cindex) != line.GetColorIndex(static_cast<size_t>(cindex - 1));
     }
 
-    return isspace(line.at(cindex).mChar) != isspace(line.at(cindex - 1).mChar);
+    return isspace(line.GetChar(cindex)) != isspace(line.GetChar(cindex - 1));
 }
 
 void TextEditor::RemoveLine(const int aStart, const int aEnd)
@@ -709,9 +867,24 @@ void TextEditor::RemoveLine(const int aStart, const int aEnd)
     }
     mBreakpoints = std::move(btmp);
 
-    mLines.erase(mLines.begin() + aStart, mLines.begin() + aEnd);
+    Lines::iterator lineIt = mLines.IteratorAt(aStart);
+    for (int i = aStart; i < aEnd; ++i, ++lineIt)
+    {
+        UncountLineWidth(*lineIt);
+    }
+    mLines.erase(aStart, aEnd);
     assert(!mLines.empty());
 
+    // The line now at aStart follows a different line, its start state has to be checked
+    mScanRanges.EraseLines(aStart, aEnd);
+    mColorRanges.EraseLines(aStart, aEnd);
+    mLayoutLines.EraseLines(aStart, aEnd);
+    mWidthRanges.EraseLines(aStart, aEnd);
+    mWrapRanges.EraseLines(aStart, aEnd);
+    EraseMinimapLines(aStart, aEnd);
+    mColorizer.EraseLines(aStart, aEnd);
+    InvalidateScan(aStart - 1, aStart);
+
     mTextChanged = true;
 }
 
@@ -743,9 +916,19 @@ void TextEditor::RemoveLine(const int aIndex)
     }
     mBreakpoints = std::move(btmp);
 
-    mLines.erase(mLines.begin() + aIndex);
+    UncountLineWidth(mLines.at(aIndex));
+    mLines.erase(aIndex);
     assert(!mLines.empty());
 
+    mScanRanges.EraseLines(aIndex, aIndex + 1);
+    mColorRanges.EraseLines(aIndex, aIndex + 1);
+    mLayoutLines.EraseLines(aIndex, aIndex + 1);
+    mWidthRanges.EraseLines(aIndex, aIndex + 1);
+    mWrapRanges.EraseLines(aIndex, aIndex + 1);
+    EraseMinimapLines(aIndex, aIndex + 1);
+    mColorizer.EraseLines(aIndex, aIndex + 1);
+    InvalidateScan(aIndex - 1, aIndex);
+
     mTextChanged = true;
 }
 
@@ -753,7 +936,18 @@ Line &TextEditor::InsertLine(const int aIndex)
 {
     assert(!mReadOnly);
 
-    std::vector<Glyph> &result = *mLines.insert(mLines.begin() + aIndex, Line());
+    Line &result = mLines.insert(aIndex);
+
+    mScanRanges.InsertLines(aIndex, 1);
+    mColorRanges.InsertLines(aIndex, 1);
+    mLayoutLines.InsertLines(aIndex, 1);
+    mWidthRanges.InsertLines(aIndex, 1);
+    mWidthRanges.Add(aIndex, aIndex + 1);
+    mWrapRanges.InsertLines(aIndex, 1);
+    mWrapRanges.Add(aIndex, aIndex + 1);
+    InsertMinimapLines(aIndex, 1);
+    mColorizer.InsertLines(aIndex, 1);
+    InvalidateScan(aIndex, aIndex + 1);
 
     ErrorMarkers etmp;
     for (const std::pair<const int, std::string> &i: mErrorMarkers)
@@ -772,6 +966,39 @@ Line &TextEditor::InsertLine(const int aIndex)
     return result;
 }
 
+void TextEditor::InsertLines(const int aIndex, std::vector<Line> &&aLines)
+{
+    assert(!mReadOnly);
+
+    const int count = static_cast<int>(aLines.size());
+    mLines.insert(aIndex, std::move(aLines));
+
+    mScanRanges.InsertLines(aIndex, count);
+    mColorRanges.InsertLines(aIndex, count);
+    mLayoutLines.InsertLines(aIndex, count);
+    mWidthRanges.InsertLines(aIndex, count);
+    mWidthRanges.Add(aIndex, aIndex + count);
+    mWrapRanges.InsertLines(aIndex, count);
+    mWrapRanges.Add(aIndex, aIndex + count);
+    InsertMinimapLines(aIndex, count);
+    mColorizer.InsertLines(aIndex, count);
+    InvalidateScan(aIndex, aIndex + count);
+
+    ErrorMarkers etmp;
+    for (const std::pair<const int, std::string> &i: mErrorMarkers)
+    {
+        etmp.insert(ErrorMarkers::value_type(i.first >= aIndex ? i.first + count : i.first, i.second));
+    }
+    mErrorMarkers = std::move(etmp);
+
+    Breakpoints btmp;
+    for (const int i: mBreakpoints)
+    {
+        btmp.insert(i >= aIndex ? i + count : i);
+    }
+    mBreakpoints = std::move(btmp);
+}
+
 std::string TextEditor::GetWordUnderCursor() const
 {
     return GetWordAt(GetCursorPosition());
@@ -782,44 +1009,53 @@ std::string TextEditor::GetWordAt(const Coordinates &aCoords) const
     const Coordinates start = FindWordStart(aCoords);
     const Coordinates end = FindWordEnd(aCoords);
 
-    std::string r;
-
     const int istart = GetCharacterIndex(start);
     const int iend = GetCharacterIndex(end);
 
-    for (int it = istart; it < iend; ++it)
+    if (istart >= iend)
     {
-        r.push_back(mLines.at(aCoords.mLine).at(it).mChar);
+        return {};
     }
-
-    return r;
+    std::string result;
+    mLines.at(aCoords.mLine).AppendChars(result, istart, iend);
+    return result;
 }
 
-ImU32 TextEditor::GetGlyphColor(const Glyph &aGlyph) const
+// Resolves the palette with the current style alpha, and the color of every glyph style (see
+// Line::GetStyle()) from it. Only does so when the palette, the alpha or the colorizer setting changed.
+void TextEditor::UpdatePalette()
 {
-    if (!mColorizerEnabled)
-    {
-        return mPalette.at(static_cast<int>(PaletteIndex::Default));
-    }
-    if (aGlyph.mComment)
+    const float alpha = ImGui::GetStyle().Alpha;
+    if (alpha == mPaletteAlpha)
     {
-        return mPalette.at(static_cast<int>(PaletteIndex::Comment));
+        return;
     }
-    if (aGlyph.mMultiLineComment)
+    mPaletteAlpha = alpha;
+    ++mMeshKey;
+    mMinimap.mRanges.Add(0, static_cast<int>(mLines.size()));
+
+    for (int i = 0; i < static_cast<int>(PaletteIndex::Max); ++i)
     {
-        return mPalette.at(static_cast<int>(PaletteIndex::MultiLineComment));
+        ImVec4 color = ImGui::ColorConvertU32ToFloat4(mPaletteBase.at(i));
+        color.w *= alpha;
+        mPalette.at(i) = ImGui::ColorConvertFloat4ToU32(color);
     }
-    const unsigned int color = mPalette.at(static_cast<int>(aGlyph.mColorIndex));
-    if (aGlyph.mPreprocessor)
+
+    const unsigned int ppcolor = mPalette.at(static_cast<int>(PaletteIndex::Preprocessor));
+    for (int i = 0; i < static_cast<int>(PaletteIndex::Max); ++i)
     {
-        const unsigned int ppcolor = mPalette.at(static_cast<int>(PaletteIndex::Preprocessor));
+        const unsigned int color = mPalette.at(mColorizerEnabled ? i : static_cast<int>(PaletteIndex::Default));
+        mStyleColors.at(i) = color;
+
+        // Preprocessor lines blend the token color with the preprocessor color
         const int c0 = ((ppcolor & 0xff) + (color & 0xff)) / 2;
         const int c1 = (((ppcolor >> 8) & 0xff) + ((color >> 8) & 0xff)) / 2;
         const int c2 = (((ppcolor >> 16) & 0xff) + ((color >> 16) & 0xff)) / 2;
         const int c3 = (((ppcolor >> 24) & 0xff) + ((color >> 24) & 0xff)) / 2;
-        return static_cast<ImU32>(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24));
+        mStyleColors.at(i | Line::kStylePreprocessor) = mColorizerEnabled
+                                                               ? static_cast<ImU32>(c0 | (c1 << 8) | (c2 << 16) | (c3 << 24))
+                                                               : color;
     }
-    return color;
 }
 
 void TextEditor::HandleKeyboardInputs()
@@ -948,6 +1184,11 @@ void TextEditor::HandleMouseInputs()
     const bool ctrl = io.ConfigMacOSXBehaviors ? io.KeySuper : io.KeyCtrl;
     const bool alt = io.ConfigMacOSXBehaviors ? io.KeyCtrl : io.KeyAlt;
 
+    if (HandleMinimapInputs())
+    {
+        return;
+    }
+
     if (ImGui::IsWindowHovered())
     {
         if (!shift && !alt)
@@ -1031,79 +1272,78 @@ void TextEditor::HandleMouseInputs()
 void TextEditor::Render()
 {
     /* Compute mCharAdvance regarding to scaled font size (Ctrl + mouse wheel)*/
-    const float
-            fontSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, "#", nullptr, nullptr).x;
+    const float fontSize = mGlyphAdvances->Advance('#');
     mCharAdvance = ImVec2(fontSize, ImGui::GetTextLineHeightWithSpacing() * mLineSpacing);
 
-    /* Update palette with the current alpha from style */
-    for (int i = 0; i < static_cast<int>(PaletteIndex::Max); ++i)
-    {
-        ImVec4 color = ImGui::ColorConvertU32ToFloat4(mPaletteBase.at(i));
-        color.w *= ImGui::GetStyle().Alpha;
-        mPalette.at(i) = ImGui::ColorConvertFloat4ToU32(color);
-    }
-
     assert(mLineBuffer.empty());
+    UpdateWhitespaceMarkers();
 
     const ImVec2 contentSize = ImGui::GetWindowContentRegionMax();
     ImDrawList *const drawList = ImGui::GetWindowDrawList();
-    float longest(mTextStart);
 
     if (mScrollToTop)
     {
         mScrollToTop = false;
-        ImGui::SetScrollY(0.f);
+        ScrollToY(0.0);
     }
 
     const ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
     const float scrollX = ImGui::GetScrollX();
-    const float scrollY = ImGui::GetScrollY();
-
-    int lineNo = static_cast<int>(floor(scrollY / mCharAdvance.y));
-    const int globalLineMax = static_cast<int>(mLines.size());
-    const int lineMax = std::max(0,
-                                 std::min(static_cast<int>(mLines.size()) - 1,
-                                          lineNo +
-                                                  static_cast<int>(floor((scrollY + contentSize.y) / mCharAdvance.y))));
 
-    // Deduce mTextStart by evaluating mLines size (global lineMax) plus two spaces as text width
-    std::array<char, 16> buf{};
-    snprintf(buf.data(), 16, " %d ", globalLineMax);
-    mTextStart = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf.data(), nullptr, nullptr).x +
-                 static_cast<float>(mLeftMargin);
+    // The cursor blinks: hidden for the first half of each period, shown for the second
+    const bool cursorShown = (NowMilliseconds() - mStartTime) % kBlinkPeriod >= kBlinkPeriod / 2;
+
+    const int firstLine = std::min(mTopLine, static_cast<int>(mLines.size()) - 1);
+    int lineNo = firstLine;
+    // Lines take a row at least, so no more of them fit
+    const int visibleMax = std::min(static_cast<int>(mLines.size()) - 1,
+                                    lineNo + static_cast<int>(ceil((ImGui::GetWindowHeight() + mTopOffset) / mCharAdvance.y)));
+
+    UpdateGutter(firstLine, visibleMax);
+    UpdateWrap(std::max(mCharAdvance.x,
+                        ImGui::GetContentRegionAvail().x - mTextStart - mCharAdvance.x - GetMinimapWidth()));
+    const int lineMax = std::clamp(GetScreenYLine(ImGui::GetWindowPos().y + ImGui::GetWindowHeight()), firstLine, visibleMax);
+
+    // The part of each line within the window, relative to the start of its text
+    const float clipLeft = ImGui::GetWindowPos().x - cursorScreenPos.x - mTextStart;
+    const float clipRight = clipLeft + ImGui::GetWindowWidth();
+    // and the screen span rows of wrapped lines are drawn within
+    const float clipTop = drawList->GetClipRectMin().y;
+    const float clipBottom = drawList->GetClipRectMax().y;
+
+    // Recorded meshes follow the layouts, and lack what ImGui culled horizontally when they were drawn
+    const float meshClipX = cursorScreenPos.x + mTextStart - drawList->GetClipRectMin().x;
+    const float meshClipWidth = drawList->GetClipRectMax().x - drawList->GetClipRectMin().x;
+    if (meshClipX != mMeshClipX || meshClipWidth != mMeshClipWidth || mLayoutKey != mMeshLayoutKey)
+    {
+        mMeshClipX = meshClipX;
+        mMeshClipWidth = meshClipWidth;
+        mMeshLayoutKey = mLayoutKey;
+        ++mMeshKey;
+    }
 
     if (!mLines.empty())
     {
-        const float spaceSize = ImGui::GetFont()
-                                        ->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr)
-                                        .x;
-
         while (lineNo <= lineMax)
         {
-            const ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x,
-                                                     cursorScreenPos.y + static_cast<float>(lineNo) * mCharAdvance.y);
+            const ImVec2 lineStartScreenPos = ImVec2(cursorScreenPos.x, GetLineScreenY(lineNo));
             const ImVec2 textScreenPos = ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
-            std::vector<Glyph> &line = mLines.at(lineNo);
-            longest = std::max(mTextStart + TextDistanceToLineStart(Coordinates(lineNo, GetLineMaxColumn(lineNo))),
-                               longest);
-            const Coordinates lineStartCoord(lineNo, 0);
-            const Coordinates lineEndCoord(lineNo, GetLineMaxColumn(lineNo));
+            Line &line = mLines.at(lineNo);
+            const std::vector<float> &layout = GetLineLayout(lineNo);
+            const std::vector<uint32_t> &wraps = GetLineWraps(lineNo);
+            const float lineHeight = static_cast<float>(wraps.size() + 1) * mCharAdvance.y;
 
-            // Draw selection for the current line
+            // Draw selection for the current line. Lines it spans are selected to the end of their layout;
+            // only the lines its ends are on need the position of a column.
             float sstart = -1.0f;
             float ssend = -1.0f;
 
             assert(mState.mSelectionStart <= mState.mSelectionEnd);
-            if (mState.mSelectionStart <= lineEndCoord)
+            if (mState.mSelectionStart.mLine <= lineNo && lineNo <= mState.mSelectionEnd.mLine)
             {
-                sstart = mState.mSelectionStart > lineStartCoord ? TextDistanceToLineStart(mState.mSelectionStart)
-                                                                 : 0.0f;
-            }
-            if (mState.mSelectionEnd > lineStartCoord)
-            {
-                ssend = TextDistanceToLineStart(mState.mSelectionEnd < lineEndCoord ? mState.mSelectionEnd
-                                                                                    : lineEndCoord);
+                sstart = mState.mSelectionStart.mLine == lineNo ? TextDistanceToLineStart(mState.mSelectionStart) : 0.0f;
+                ssend = mState.mSelectionEnd.mLine == lineNo ? TextDistanceToLineStart(mState.mSelectionEnd) : layout.back();
             }
 
             if (mState.mSelectionEnd.mLine > lineNo)
@@ -1113,9 +1353,24 @@ void TextEditor::Render()
 
             if (sstart != -1 && ssend != -1 && sstart < ssend)
             {
-                const ImVec2 vstart(lineStartScreenPos.x + mTextStart + sstart, lineStartScreenPos.y);
-                const ImVec2 vend(lineStartScreenPos.x + mTextStart + ssend, lineStartScreenPos.y + mCharAdvance.y);
-                drawList->AddRectFilled(vstart, vend, mPalette.at(static_cast<int>(PaletteIndex::Selection)));
+                // The part of it on each row on screen
+                const float firstRow = std::max(0.0f, std::floor((clipTop - lineStartScreenPos.y) / mCharAdvance.y));
+                const float lastRow = std::floor((clipBottom - lineStartScreenPos.y) / mCharAdvance.y);
+                for (size_t row = static_cast<size_t>(firstRow); static_cast<float>(row) <= lastRow && row <= wraps.size(); ++row)
+                {
+                    const float rowLeft = row > 0 ? layout.at(wraps.at(row - 1)) : 0.0f;
+                    const float rowRight = row < wraps.size() ? layout.at(wraps.at(row))
+                                                              : std::numeric_limits<float>::max();
+                    const float left = std::max(sstart, rowLeft);
+                    const float right = std::min(ssend, rowRight);
+                    if (left < right)
+                    {
+                        const float y = lineStartScreenPos.y + static_cast<float>(row) * mCharAdvance.y;
+                        const ImVec2 vstart(textScreenPos.x + left - rowLeft, y);
+                        const ImVec2 vend(textScreenPos.x + right - rowLeft, y + mCharAdvance.y);
+                        drawList->AddRectFilled(vstart, vend, mPalette.at(static_cast<int>(PaletteIndex::Selection)));
+                    }
+                }
             }
 
             // Draw breakpoints
@@ -1124,7 +1379,7 @@ void TextEditor::Render()
             if (mBreakpoints.contains(lineNo + 1))
             {
                 const ImVec2 end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX,
-                                          lineStartScreenPos.y + mCharAdvance.y);
+                                          lineStartScreenPos.y + lineHeight);
                 drawList->AddRectFilled(start, end, mPalette.at(static_cast<int>(PaletteIndex::Breakpoint)));
             }
 
@@ -1133,7 +1388,7 @@ void TextEditor::Render()
             if (errorIt != mErrorMarkers.end())
             {
                 const ImVec2 end = ImVec2(lineStartScreenPos.x + contentSize.x + 2.0f * scrollX,
-                                          lineStartScreenPos.y + mCharAdvance.y);
+                                          lineStartScreenPos.y + lineHeight);
                 drawList->AddRectFilled(start, end, mPalette.at(static_cast<int>(PaletteIndex::ErrorMarker)));
 
                 if (ImGui::IsMouseHoveringRect(lineStartScreenPos, end))
@@ -1150,21 +1405,6 @@ void TextEditor::Render()
                 }
             }
 
-            // Draw line number (right aligned)
-            snprintf(buf.data(), 16, "%d  ", lineNo + 1);
-
-            const float lineNoWidth = ImGui::GetFont()
-                                              ->CalcTextSizeA(ImGui::GetFontSize(),
-                                                              FLT_MAX,
-                                                              -1.0f,
-                                                              buf.data(),
-                                                              nullptr,
-                                                              nullptr)
-                                              .x;
-            drawList->AddText(ImVec2(lineStartScreenPos.x + mTextStart - lineNoWidth, lineStartScreenPos.y),
-                              mPalette.at(static_cast<int>(PaletteIndex::LineNumber)),
-                              buf.data());
-
             if (mState.mCursorPosition.mLine == lineNo)
             {
                 const bool focused = ImGui::IsWindowFocused();
@@ -1172,7 +1412,7 @@ void TextEditor::Render()
                 // Highlight the current line (where the cursor is)
                 if (!HasSelection())
                 {
-                    const ImVec2 end = ImVec2(start.x + contentSize.x + scrollX, start.y + mCharAdvance.y);
+                    const ImVec2 end = ImVec2(start.x + contentSize.x + scrollX, start.y + lineHeight);
                     drawList->AddRectFilled(start,
                                             end,
                                             mPalette.at(static_cast<
@@ -1184,127 +1424,92 @@ void TextEditor::Render()
                 // Render the cursor
                 if (focused)
                 {
-                    const int64_t timeEnd = std::chrono::duration_cast<
-                                                    std::chrono::milliseconds>(std::chrono::system_clock::now()
-                                                                                       .time_since_epoch())
-                                                    .count();
-                    const uint64_t elapsed = timeEnd - mStartTime;
-                    if (elapsed > 400)
+                    if (cursorShown)
                     {
                         float width = 1.0f;
-                        const int cindex = GetCharacterIndex(mState.mCursorPosition);
-                        const float cx = TextDistanceToLineStart(mState.mCursorPosition);
+                        const int cindex = std::min(static_cast<int>(line.size()),
+                                                    GetCharacterIndex(mState.mCursorPosition));
+                        const float cx = layout.at(cindex);
 
                         if (mOverwrite && cindex < static_cast<int>(line.size()))
                         {
-                            const Char c = line.at(cindex).mChar;
-                            if (c == '\t')
-                            {
-                                const float x = (1.0f +
-                                                 std::floor((1.0f + cx) / (static_cast<float>(mTabSize) * spaceSize))) *
-                                                (static_cast<float>(mTabSize) * spaceSize);
-                                width = x - cx;
-                            } else
-                            {
-                                std::array<char, 2> buf2{};
-                                buf2.at(0) = line.at(cindex).mChar;
-                                buf2.at(1) = '\0';
-                                width = ImGui::GetFont()
-                                                ->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, buf2.data())
-                                                .x;
-                            }
+                            const size_t next = std::min(line.size(),
+                                                         static_cast<size_t>(cindex + UTF8CharLength(line.GetChar(cindex))));
+                            width = layout.at(next) - cx;
                         }
-                        const ImVec2 cstart(textScreenPos.x + cx, lineStartScreenPos.y);
-                        const ImVec2 cend(textScreenPos.x + cx + width, lineStartScreenPos.y + mCharAdvance.y);
+                        // On the row it is on, at the start of the next one if a row breaks there
+                        const size_t row = FindRow(wraps, cindex);
+                        const float x = textScreenPos.x + cx - (row > 0 ? layout.at(wraps.at(row - 1)) : 0.0f);
+                        const float y = lineStartScreenPos.y + static_cast<float>(row) * mCharAdvance.y;
+                        const ImVec2 cstart(x, y);
+                        const ImVec2 cend(x + width, y + mCharAdvance.y);
                         drawList->AddRectFilled(cstart, cend, mPalette.at(static_cast<int>(PaletteIndex::Cursor)));
-                        if (elapsed > 800)
-                        {
-                            mStartTime = timeEnd;
-                        }
                     }
                 }
             }
 
             // Render colorized text
-            unsigned int prevColor = line.empty() ? mPalette.at(static_cast<int>(PaletteIndex::Default))
-                                                  : GetGlyphColor(line.at(0));
-            ImVec2 bufferOffset;
-
-            for (size_t i = 0; i < line.size();)
+            if (!mRetainedRendering)
             {
-                const Glyph &glyph = line.at(i);
-                const ImU32 color = GetGlyphColor(glyph);
-
-                if ((color != prevColor || glyph.mChar == '\t' || glyph.mChar == ' ') && !mLineBuffer.empty())
-                {
-                    const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-                    drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-                    const ImVec2 textSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(),
-                                                                            FLT_MAX,
-                                                                            -1.0f,
-                                                                            mLineBuffer.c_str(),
-                                                                            nullptr,
-                                                                            nullptr);
-                    bufferOffset.x += textSize.x;
-                    mLineBuffer.clear();
-                }
-                prevColor = color;
-
-                if (glyph.mChar == '\t')
-                {
-                    const float oldX = bufferOffset.x;
-                    bufferOffset.x = (1.0f + std::floor((1.0f + bufferOffset.x) /
-                                                        (static_cast<float>(mTabSize) * spaceSize))) *
-                                     (static_cast<float>(mTabSize) * spaceSize);
-                    ++i;
-
-                    if (mShowWhitespaces)
-                    {
-                        const float s = ImGui::GetFontSize();
-                        const float x1 = textScreenPos.x + oldX + 1.0f;
-                        const float x2 = textScreenPos.x + bufferOffset.x - 1.0f;
-                        const float y = textScreenPos.y + bufferOffset.y + s * 0.5f;
-                        const ImVec2 p1(x1, y);
-                        const ImVec2 p2(x2, y);
-                        const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
-                        const ImVec2 p4(x2 - s * 0.2f, y + s * 0.2f);
-                        drawList->AddLine(p1, p2, 0x90909090);
-                        drawList->AddLine(p2, p3, 0x90909090);
-                        drawList->AddLine(p2, p4, 0x90909090);
-                    }
-                } else if (glyph.mChar == ' ')
+                DrawLineText(drawList, line, layout, wraps, textScreenPos, clipLeft, clipRight, clipTop, clipBottom);
+            } else if (const Line::Mesh *mesh = line.GetMesh(mMeshKey))
+            {
+                DrawLineMesh(drawList, *mesh, textScreenPos);
+            } else
+            {
+                // Record what is drawn, unless ImGui culled part of it: lines not entirely within the
+                // clip rect vertically, or split across draw commands
+                const int cmdCount = drawList->CmdBuffer.Size;
+                const int vtxStart = drawList->VtxBuffer.Size;
+                const int idxStart = drawList->IdxBuffer.Size;
+                const unsigned int firstIndex = drawList->_VtxCurrentIdx;
+                DrawLineText(drawList, line, layout, wraps, textScreenPos, clipLeft, clipRight, clipTop, clipBottom);
+                if (drawList->CmdBuffer.Size == cmdCount &&
+                    textScreenPos.y >= drawList->GetClipRectMin().y &&
+                    textScreenPos.y + lineHeight <= drawList->GetClipRectMax().y)
                 {
-                    if (mShowWhitespaces)
+                    const std::shared_ptr<Line::Mesh> recorded = std::make_shared<Line::Mesh>();
+                    recorded->mKey = mMeshKey;
+                    recorded->mVertices.assign(drawList->VtxBuffer.Data + vtxStart,
+                                               drawList->VtxBuffer.Data + drawList->VtxBuffer.Size);
+                    for (ImDrawVert &vertex: recorded->mVertices)
                     {
-                        const float s = ImGui::GetFontSize();
-                        const float x = textScreenPos.x + bufferOffset.x + spaceSize * 0.5f;
-                        const float y = textScreenPos.y + bufferOffset.y + s * 0.5f;
-                        drawList->AddCircleFilled(ImVec2(x, y), 1.5f, 0x80808080, 4);
+                        vertex.pos.x -= textScreenPos.x;
+                        vertex.pos.y -= textScreenPos.y;
                     }
-                    bufferOffset.x += spaceSize;
-                    i++;
-                } else
-                {
-                    int l = UTF8CharLength(glyph.mChar);
-                    while (l-- > 0)
+                    recorded->mIndices.reserve(drawList->IdxBuffer.Size - idxStart);
+                    for (int i = idxStart; i < drawList->IdxBuffer.Size; ++i)
                     {
-                        mLineBuffer.push_back(line.at(i++).mChar);
+                        recorded->mIndices.push_back(static_cast<ImDrawIdx>(drawList->IdxBuffer[i] - firstIndex));
                     }
+                    line.SetMesh(recorded);
                 }
             }
 
-            if (!mLineBuffer.empty())
-            {
-                const ImVec2 newOffset(textScreenPos.x + bufferOffset.x, textScreenPos.y + bufferOffset.y);
-                drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-                mLineBuffer.clear();
-            }
-
             ++lineNo;
         }
 
+        // Draw the line numbers (right aligned) in one go
+        const ImU32 lineNumberColor = mPalette.at(static_cast<int>(PaletteIndex::LineNumber));
+        uint32_t numberStart = 0;
+        for (int i = 0; i < static_cast<int>(mGutter.mNumbers.size()) && mGutter.mFirstLine + i <= lineMax; ++i)
+        {
+            const std::pair<uint32_t, float> &number = mGutter.mNumbers.at(i);
+            const ImVec2 pos(cursorScreenPos.x + mTextStart - number.second, GetLineScreenY(mGutter.mFirstLine + i));
+            drawList->AddText(pos,
+                              lineNumberColor,
+                              mGutter.mText.data() + numberStart,
+                              mGutter.mText.data() + number.first);
+            numberStart = number.first;
+        }
+
+        if (mShowMinimap)
+        {
+            DrawMinimap(drawList, firstLine, lineMax);
+        }
+
         // Draw a tooltip on known identifiers/preprocessor symbols
-        if (ImGui::IsMousePosValid())
+        if (ImGui::IsMousePosValid() && !ImGui::IsMouseHoveringRect(mMinimap.mMin, mMinimap.mMax))
         {
             const std::string id = GetWordAt(ScreenPosToCoordinates(ImGui::GetMousePos()));
             if (!id.empty())
@@ -1331,8 +1536,15 @@ void TextEditor::Render()
         }
     }
 
+    UpdateLineWidths();
+    const float longest = mTextStart + GetLongestLineWidth();
+    // Wide enough to scroll the longest line out from under the minimap
+    ImGui::Dummy(ImVec2(mWordWrap ? 0.0f : longest + 2 + GetMinimapWidth(),
+                        static_cast<float>(std::min(GetDocumentHeight(), kMaxScrollHeight))));
 
-    ImGui::Dummy(ImVec2((longest + 2), static_cast<float>(mLines.size()) * mCharAdvance.y));
+    // Keep the layouts of a screenful of lines either side, for scrolling back and forth
+    const int visibleCount = lineMax - firstLine + 1;
+    TrimLineLayouts(firstLine - visibleCount, lineMax + 1 + visibleCount);
 
     if (mScrollToCursor)
     {
@@ -1340,105 +1552,436 @@ void TextEditor::Render()
         ImGui::SetWindowFocus();
         mScrollToCursor = false;
     }
-}
-
-void TextEditor::Render(const char *aTitle, const ImVec2 &aSize, bool aBorder)
-{
-    mWithinRender = true;
-    mTextChanged = false;
-    mCursorPositionChanged = false;
 
-    ImGui::PushStyleColor(ImGuiCol_ChildBg,
-                          ImGui::ColorConvertU32ToFloat4(mPalette.at(static_cast<int>(PaletteIndex::Background))));
-    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0.0f, 0.0f));
-    if (!mIgnoreImGuiChild)
+    // Show the position in ImGui's scrollbar, proportionally if the document is too tall for it
+    if (mVirtualScroll)
     {
-        ImGui::BeginChild(aTitle,
-                          aSize,
-                          aBorder ? ImGuiChildFlags_Borders : ImGuiChildFlags_None,
-                          ImGuiWindowFlags_HorizontalScrollbar |
-                                  ImGuiWindowFlags_AlwaysHorizontalScrollbar |
-                                  ImGuiWindowFlags_NoMove);
+        const double range = GetScrollRange();
+        mScrollY = range > 0.0 ? std::floor(static_cast<float>(GetScrollTop() / range) * ImGui::GetScrollMaxY()) : 0.0f;
+    } else
+    {
+        mScrollY = std::round(static_cast<float>(GetScrollTop()));
     }
-
-    if (mHandleKeyboardInputs)
+    if (mScrollY != ImGui::GetScrollY())
     {
-        HandleKeyboardInputs();
-        ImGui::PushItemFlag(ImGuiItemFlags_NoTabStop, false);
+        ImGui::SetScrollY(mScrollY);
     }
 
-    if (mHandleMouseInputs)
+    FrameState frame;
+    CaptureFrameState(frame);
+    frame.mScrollX = scrollX;
+    frame.mScrollY = static_cast<float>(GetScrollTop());
+    frame.mWidth = ImGui::GetWindowWidth();
+    frame.mHeight = ImGui::GetWindowHeight();
+    frame.mFocused = ImGui::IsWindowFocused();
+    frame.mCursorShown = frame.mFocused && cursorShown;
+    frame.mHovered = ImGui::IsWindowHovered();
+    if (frame.mHovered)
     {
-        HandleMouseInputs();
+        frame.mMouseX = ImGui::GetMousePos().x;
+        frame.mMouseY = ImGui::GetMousePos().y;
     }
+    mFrameChanged = !(frame == mFrameState);
+    mFrameState = frame;
+}
 
-    ColorizeInternal();
-    Render();
+// Fills in the parts of aFrame that do not depend on ImGui
+void TextEditor::CaptureFrameState(FrameState &aFrame) const
+{
+    aFrame.mDocumentVersion = mDocumentVersion;
+    aFrame.mState = mState;
+    aFrame.mMarkersVersion = mMarkersVersion;
+    aFrame.mLayoutKey = mLayoutKey;
+    aFrame.mMeshKey = mMeshKey;
+    aFrame.mShowMinimap = mShowMinimap;
+}
 
-    if (mHandleKeyboardInputs)
+bool TextEditor::IsRenderNeeded() const
+{
+    // Still settling from the last frame, or to be set up
+    if (mFrameChanged || mScrollToCursor || mScrollToTop || mPaletteAlpha < 0.0f)
     {
-        ImGui::PopItemFlag();
+        return true;
     }
-
-    if (!mIgnoreImGuiChild)
+    // Colorizing has work left
+    if (mColorizerEnabled && (!mColorRanges.empty() || !mScanRanges.empty()))
     {
-        ImGui::EndChild();
+        return true;
     }
-
-    ImGui::PopStyleVar();
-    ImGui::PopStyleColor();
-
-    mWithinRender = false;
+    // Wrapping has lines left to count the rows of
+    if (mWordWrap && (mWrapLayoutKey != mLayoutKey || !mWrapRanges.empty()))
+    {
+        return true;
+    }
+    // The longest line is still being looked for
+    if (!mWordWrap && (mWidthKey != mLayoutKey || !mWidthRanges.empty()))
+    {
+        return true;
+    }
+    // Changed through the API since the last frame
+    FrameState current = mFrameState;
+    CaptureFrameState(current);
+    if (!(current == mFrameState))
+    {
+        return true;
+    }
+    return GetTimeToNextBlink() == 0;
 }
 
-void TextEditor::SetText(const std::string &aText)
+int TextEditor::GetTimeToNextBlink() const
 {
-    mLines.clear();
-    mLines.emplace_back();
-    for (const char chr: aText)
+    if (!mFrameState.mFocused)
     {
-        if (chr == '\r')
-        {
-            // ignore the carriage return character
-        } else if (chr == '\n')
-        {
-            mLines.emplace_back();
-        } else
-        {
-            mLines.back().emplace_back(chr, PaletteIndex::Default);
-        }
+        return -1;
     }
-
-    mTextChanged = true;
-    mScrollToTop = true;
-
-    mUndoBuffer.clear();
-    mUndoIndex = 0;
-
-    Colorize();
+    const uint64_t phase = (NowMilliseconds() - mStartTime) % kBlinkPeriod;
+    const uint64_t due = phase < kBlinkPeriod / 2 ? kBlinkPeriod / 2 : kBlinkPeriod;
+    // Due now if the last frame still shows the cursor as it was before the transition
+    const bool shown = phase >= kBlinkPeriod / 2;
+    return shown != mFrameState.mCursorShown ? 0 : static_cast<int>(due - phase);
 }
 
-void TextEditor::SetTextLines(const std::vector<std::string> &aLines)
+// Draws the text of aLine starting at aTextPos: the rows of it within the screen span [aClipTop,
+// aClipBottom] one below the other if it is wrapped, otherwise the glyphs within [aClipLeft, aClipRight]
+void TextEditor::DrawLineText(ImDrawList *aDrawList,
+                              Line &aLine,
+                              const std::vector<float> &aLayout,
+                              const std::vector<uint32_t> &aWraps,
+                              const ImVec2 &aTextPos,
+                              const float aClipLeft,
+                              const float aClipRight,
+                              const float aClipTop,
+                              const float aClipBottom)
 {
-    mLines.clear();
+    if (!aLine.HasStyleRuns())
+    {
+        aLine.UpdateStyleRuns();
+    }
 
-    if (aLines.empty())
+    if (aWraps.empty())
     {
-        mLines.emplace_back();
-    } else
+        const size_t firstGlyph = FindGlyph(aLayout, aClipLeft);
+        const size_t lastGlyph = FindGlyph(aLayout, aClipRight);
+        const size_t clipEnd = lastGlyph < aLine.size()
+                                       ? std::min(aLine.size(), lastGlyph + UTF8CharLength(aLine.GetChar(lastGlyph)))
+                                       : aLine.size();
+        DrawGlyphs(aDrawList, aLine, aLayout, aTextPos, firstGlyph, clipEnd);
+        return;
+    }
+
+    // Only the rows on screen, however many the line has
+    const float firstRow = std::floor((aClipTop - aTextPos.y) / mCharAdvance.y);
+    const float lastRow = std::floor((aClipBottom - aTextPos.y) / mCharAdvance.y);
+    if (lastRow < 0.0f || firstRow > static_cast<float>(aWraps.size()))
+    {
+        return;
+    }
+    const size_t rowCount = std::min(aWraps.size(), static_cast<size_t>(lastRow)) + 1;
+    size_t row = static_cast<size_t>(std::max(0.0f, firstRow));
+    size_t rowStart = row > 0 ? aWraps.at(row - 1) : 0;
+    for (; row < rowCount; ++row)
+    {
+        const size_t rowEnd = row < aWraps.size() ? aWraps.at(row) : aLine.size();
+        const ImVec2 rowPos(aTextPos.x - aLayout.at(rowStart), aTextPos.y + static_cast<float>(row) * mCharAdvance.y);
+        DrawGlyphs(aDrawList, aLine, aLayout, rowPos, rowStart, rowEnd);
+        rowStart = rowEnd;
+    }
+}
+
+// Draws the glyphs [aFrom, aTo) of aLine, its text starting at aTextPos, one draw per run of equally
+// styled glyphs. The line's style runs have to be up to date.
+void TextEditor::DrawGlyphs(ImDrawList *aDrawList,
+                            const Line &aLine,
+                            const std::vector<float> &aLayout,
+                            const ImVec2 &aTextPos,
+                            const size_t aFrom,
+                            const size_t aTo)
+{
+    const std::vector<Line::StyleRun> &runs = aLine.GetStyleRuns();
+    const bool showWhitespaces = mShowWhitespaces && mWhitespaceMarkers.mVisible;
+
+    // The run aFrom is in
+    std::vector<Line::StyleRun>::const_iterator run = std::upper_bound(runs.begin(),
+                                                                        runs.end(),
+                                                                        aFrom,
+                                                                        [](const size_t aIndex,
+                                                                           const Line::StyleRun &aRun) {
+                                                                            return aIndex < aRun.mStart;
+                                                                        });
+    if (run != runs.begin())
     {
-        mLines.resize(aLines.size());
+        --run;
+    }
+
+    for (; run != runs.end() && run->mStart < aTo; ++run)
+    {
+        const size_t from = std::max(static_cast<size_t>(run->mStart), aFrom);
+        const size_t to = std::min(static_cast<size_t>(run->mStart) + run->mLength, aTo);
+
+        if (aLine.GetChar(from) == '\t')
+        {
+            if (showWhitespaces)
+            {
+                for (size_t i = from; i < to; ++i)
+                {
+                    mTabMarkers.emplace_back(aLayout.at(i) + 1.0f, aLayout.at(i + 1) - 1.0f);
+                }
+            }
+            continue;
+        }
 
-        for (size_t i = 0; i < aLines.size(); ++i)
+        // Runs straddling the gap left by the last edit are copied rather than closing it
+        const char *chars = aLine.CharRange(from, to);
+        if (chars == nullptr)
         {
-            const std::string &aLine = aLines.at(i);
+            for (size_t i = from; i < to; ++i)
+            {
+                mLineBuffer.push_back(static_cast<char>(aLine.GetChar(i)));
+            }
+            chars = mLineBuffer.data();
+        }
+        const char *charsEnd = chars + (to - from);
 
-            mLines.at(i).reserve(aLine.size());
-            for (const char j: aLine)
+        aDrawList->AddText(ImVec2(aTextPos.x + aLayout.at(from), aTextPos.y), mStyleColors[run->mStyle], chars, charsEnd);
+
+        if (showWhitespaces)
+        {
+            for (const char *space = chars;
+                 (space = static_cast<const char *>(memchr(space, ' ', charsEnd - space))) != nullptr;
+                 ++space)
             {
-                mLines.at(i).emplace_back(j, PaletteIndex::Default);
+                const size_t i = from + (space - chars);
+                mSpaceMarkers.push_back((aLayout.at(i) + aLayout.at(i + 1)) * 0.5f);
             }
         }
+        mLineBuffer.clear();
+    }
+
+    if (showWhitespaces)
+    {
+        DrawWhitespaceMarkers(aDrawList, aTextPos);
+    }
+}
+
+// Builds the whitespace marker shapes for the current font size: a dot for spaces, and an arrow for
+// tabs whose shaft is stretched to the width of the tab. Each line of the arrow is a quad one pixel wide.
+void TextEditor::UpdateWhitespaceMarkers()
+{
+    const float s = ImGui::GetFontSize();
+    if (s == mWhitespaceMarkers.mFontSize)
+    {
+        return;
+    }
+    mWhitespaceMarkers.mFontSize = s;
+
+    // Markers smaller than a pixel are not drawn at all
+    mWhitespaceMarkers.mVisible = s * 0.2f >= 1.0f;
+
+    constexpr float radius = 1.5f;
+    mWhitespaceMarkers.mDot = {ImVec2(0.0f, -radius), ImVec2(radius, 0.0f), ImVec2(0.0f, radius), ImVec2(-radius, 0.0f)};
+
+    // The two lines of the arrow head, from its tip at (0, 0)
+    const std::array<ImVec2, 2> ends = {ImVec2(-s * 0.2f, -s * 0.2f), ImVec2(-s * 0.2f, s * 0.2f)};
+    for (size_t i = 0; i < ends.size(); ++i)
+    {
+        const ImVec2 end = ends.at(i);
+        const float length = std::sqrt(end.x * end.x + end.y * end.y);
+        const ImVec2 normal(-end.y / length * 0.5f, end.x / length * 0.5f);
+        mWhitespaceMarkers.mArrowHead.at(i * 4) = ImVec2(normal.x, normal.y);
+        mWhitespaceMarkers.mArrowHead.at(i * 4 + 1) = ImVec2(end.x + normal.x, end.y + normal.y);
+        mWhitespaceMarkers.mArrowHead.at(i * 4 + 2) = ImVec2(end.x - normal.x, end.y - normal.y);
+        mWhitespaceMarkers.mArrowHead.at(i * 4 + 3) = ImVec2(-normal.x, -normal.y);
+    }
+}
+
+// Draws the markers collected in mSpaceMarkers and mTabMarkers for a line whose text starts at
+// aTextPos with a single reservation, and empties them
+void TextEditor::DrawWhitespaceMarkers(ImDrawList *aDrawList, const ImVec2 &aTextPos)
+{
+    // Quads: one per space, three per tab
+    const int quads = static_cast<int>(mSpaceMarkers.size() + mTabMarkers.size() * 3);
+    if (quads == 0)
+    {
+        return;
+    }
+
+    constexpr ImU32 spaceColor = 0x80808080;
+    constexpr ImU32 tabColor = 0x90909090;
+    const ImVec2 uv = aDrawList->_Data->TexUvWhitePixel;
+    const float y = aTextPos.y + mWhitespaceMarkers.mFontSize * 0.5f;
+
+    aDrawList->PrimReserve(quads * 6, quads * 4);
+    unsigned int index = aDrawList->_VtxCurrentIdx;
+    const auto quad = [aDrawList, &index, &uv](const ImVec2 &aOrigin, const ImVec2 *aCorners, const ImU32 aColor) {
+        for (int i = 0; i < 4; ++i)
+        {
+            *aDrawList->_VtxWritePtr++ = ImDrawVert{ImVec2(aOrigin.x + aCorners[i].x, aOrigin.y + aCorners[i].y),
+                                                    uv,
+                                                    aColor};
+        }
+        for (const unsigned int corner: {0u, 1u, 2u, 0u, 2u, 3u})
+        {
+            *aDrawList->_IdxWritePtr++ = static_cast<ImDrawIdx>(index + corner);
+        }
+        index += 4;
+    };
+
+    for (const float x: mSpaceMarkers)
+    {
+        quad(ImVec2(aTextPos.x + x, y), mWhitespaceMarkers.mDot.data(), spaceColor);
+    }
+    for (const std::pair<float, float> &tab: mTabMarkers)
+    {
+        const ImVec2 tip(aTextPos.x + tab.second, y);
+        const std::array<ImVec2, 4> shaft = {ImVec2(tab.first - tab.second, -0.5f),
+                                             ImVec2(0.0f, -0.5f),
+                                             ImVec2(0.0f, 0.5f),
+                                             ImVec2(tab.first - tab.second, 0.5f)};
+        quad(tip, shaft.data(), tabColor);
+        quad(tip, mWhitespaceMarkers.mArrowHead.data(), tabColor);
+        quad(tip, mWhitespaceMarkers.mArrowHead.data() + 4, tabColor);
+    }
+    aDrawList->_VtxCurrentIdx = index;
+
+    mSpaceMarkers.clear();
+    mTabMarkers.clear();
+}
+
+// Draws a mesh recorded by Render() again, with its text starting at aTextPos
+void TextEditor::DrawLineMesh(ImDrawList *aDrawList, const Line::Mesh &aMesh, const ImVec2 &aTextPos)
+{
+    if (aMesh.mIndices.empty())
+    {
+        return;
+    }
+
+    const int vtxCount = static_cast<int>(aMesh.mVertices.size());
+    aDrawList->PrimReserve(static_cast<int>(aMesh.mIndices.size()), vtxCount);
+    const unsigned int firstIndex = aDrawList->_VtxCurrentIdx;
+    for (const ImDrawVert &vertex: aMesh.mVertices)
+    {
+        ImDrawVert &out = *aDrawList->_VtxWritePtr++;
+        out = vertex;
+        out.pos.x += aTextPos.x;
+        out.pos.y += aTextPos.y;
+    }
+    for (const ImDrawIdx index: aMesh.mIndices)
+    {
+        *aDrawList->_IdxWritePtr++ = static_cast<ImDrawIdx>(index + firstIndex);
+    }
+    aDrawList->_VtxCurrentIdx += vtxCount;
+}
+
+void TextEditor::Render(const char *aTitle, const ImVec2 &aSize, bool aBorder)
+{
+    mWithinRender = true;
+    mTextChanged = false;
+    mCursorPositionChanged = false;
+
+    // Pick up the colorizer thread's work before this frame's edits can invalidate it
+    if (mColorizer.mThread != nullptr)
+    {
+        if (const std::unique_ptr<ColorizeJob> job = mColorizer.mThread->TakeFinished())
+        {
+            ApplyColorizeJob(*job);
+        }
+    }
+
+    UpdateLayoutKey();
+    UpdatePalette();
+
+    ImGui::PushStyleColor(ImGuiCol_ChildBg,
+                          ImGui::ColorConvertU32ToFloat4(mPalette.at(static_cast<int>(PaletteIndex::Background))));
+    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0.0f, 0.0f));
+    if (!mIgnoreImGuiChild)
+    {
+        ImGui::BeginChild(aTitle,
+                          aSize,
+                          aBorder ? ImGuiChildFlags_Borders : ImGuiChildFlags_None,
+                          // A wrapped document keeps its width whether it scrolls or not
+                          (mWordWrap ? ImGuiWindowFlags_AlwaysVerticalScrollbar
+                                     : ImGuiWindowFlags_HorizontalScrollbar | ImGuiWindowFlags_AlwaysHorizontalScrollbar) |
+                                  ImGuiWindowFlags_NoMove);
+    }
+
+    UpdateScroll();
+
+    if (mHandleKeyboardInputs)
+    {
+        HandleKeyboardInputs();
+        ImGui::PushItemFlag(ImGuiItemFlags_NoTabStop, false);
+    }
+
+    if (mHandleMouseInputs)
+    {
+        HandleMouseInputs();
+    }
+
+    ColorizeInternal();
+    Render();
+
+    if (mHandleKeyboardInputs)
+    {
+        ImGui::PopItemFlag();
+    }
+
+    if (!mIgnoreImGuiChild)
+    {
+        ImGui::EndChild();
+    }
+
+    ImGui::PopStyleVar();
+    ImGui::PopStyleColor();
+
+    mWithinRender = false;
+}
+
+void TextEditor::SetText(const std::string &aText)
+{
+    mLines.clear();
+    ClearLineRanges();
+    std::vector<Line> lines;
+    const char *end = aText.data() + aText.size();
+    for (const char *p = aText.data();;)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        std::string line;
+        AppendWithoutCR(line, p, (nl != nullptr ? nl : end) - p); // ignore the carriage return characters
+        lines.emplace_back(std::move(line));
+        if (nl == nullptr)
+        {
+            break;
+        }
+        p = nl + 1;
+    }
+    mLines.insert(0, std::move(lines));
+
+    mTextChanged = true;
+    mScrollToTop = true;
+
+    mUndoBuffer.clear();
+    mUndoIndex = 0;
+
+    Colorize();
+}
+
+void TextEditor::SetTextLines(const std::vector<std::string> &aLines)
+{
+    mLines.clear();
+    ClearLineRanges();
+
+    if (aLines.empty())
+    {
+        mLines.emplace_back();
+    } else
+    {
+        std::vector<Line> lines;
+        lines.reserve(aLines.size());
+        for (const std::string &aLine: aLines)
+        {
+            lines.emplace_back(aLine);
+        }
+        mLines.insert(0, std::move(lines));
     }
 
     mTextChanged = true;
@@ -1493,27 +2036,27 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
 
             for (int i = start.mLine; i <= end.mLine; i++)
             {
-                std::vector<Glyph> &line = mLines.at(i);
+                Line &line = mLines.at(i);
                 if (aShift)
                 {
                     if (!line.empty())
                     {
-                        if (line.front().mChar == '\t')
+                        if (line.GetChar(0) == '\t')
                         {
-                            line.erase(line.begin());
+                            line.erase(0, 1);
                             modified = true;
                         } else
                         {
-                            for (int j = 0; j < mTabSize && !line.empty() && line.front().mChar == ' '; j++)
+                            for (int j = 0; j < mTabSize && !line.empty() && line.GetChar(0) == ' '; j++)
                             {
-                                line.erase(line.begin());
+                                line.erase(0, 1);
                                 modified = true;
                             }
                         }
                     }
                 } else
                 {
-                    line.insert(line.begin(), Glyph('\t', PaletteIndex::Background));
+                    line.insert(0, "\t", 1, PaletteIndex::Background);
                     modified = true;
                 }
             }
@@ -1543,6 +2086,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
                 AddUndo(u);
 
                 mTextChanged = true;
+                Colorize(start.mLine, end.mLine - start.mLine + 1);
 
                 EnsureCursorVisible();
             }
@@ -1565,23 +2109,23 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
     if (aChar == '\n')
     {
         (void)InsertLine(coord.mLine + 1);
-        std::vector<Glyph> &line = mLines.at(coord.mLine);
-        std::vector<Glyph> &newLine = mLines.at(coord.mLine + 1);
+        Line &line = mLines.at(coord.mLine);
+        Line &newLine = mLines.at(coord.mLine + 1);
 
         if (mLanguageDefinition.mAutoIndentation)
         {
             for (size_t it = 0;
-                 it < line.size() && (isascii(line.at(it).mChar) != 0) && (isblank(line.at(it).mChar) != 0);
+                 it < line.size() && (isascii(line.GetChar(it)) != 0) && (isblank(line.GetChar(it)) != 0);
                  ++it)
             {
-                newLine.push_back(line.at(it));
+                newLine.append(line, it, it + 1);
             }
         }
 
         const size_t whitespaceSize = newLine.size();
         const int cindex = GetCharacterIndex(coord);
-        newLine.insert(newLine.end(), line.begin() + cindex, line.end());
-        line.erase(line.begin() + cindex, line.begin() + line.size());
+        newLine.append(line, cindex, line.size());
+        line.erase(cindex, line.size());
         SetCursorPosition(Coordinates(coord.mLine + 1,
                                       GetCharacterColumn(coord.mLine + 1, static_cast<int>(whitespaceSize))));
         u.mAdded = static_cast<char>(aChar);
@@ -1592,27 +2136,25 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift)
         if (e > 0)
         {
             buf[e] = '\0';
-            std::vector<Glyph> &line = mLines.at(coord.mLine);
+            Line &line = mLines.at(coord.mLine);
             int cindex = GetCharacterIndex(coord);
 
             if (mOverwrite && cindex < static_cast<int>(line.size()))
             {
-                int d = UTF8CharLength(line.at(cindex).mChar);
+                int d = UTF8CharLength(line.GetChar(cindex));
 
                 u.mRemovedStart = mState.mCursorPosition;
                 u.mRemovedEnd = Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex + d));
 
                 while (d-- > 0 && cindex < static_cast<int>(line.size()))
                 {
-                    u.mRemoved += line.at(cindex).mChar;
-                    line.erase(line.begin() + cindex);
+                    u.mRemoved += line.GetChar(cindex);
+                    line.erase(cindex, cindex + 1);
                 }
             }
 
-            for (const char *p = buf; *p != '\0'; p++, ++cindex)
-            {
-                line.insert(line.begin() + cindex, Glyph(*p, PaletteIndex::Default));
-            }
+            line.insert(cindex, buf, e);
+            cindex += e;
             u.mAdded = buf;
 
             SetCursorPosition(Coordinates(coord.mLine, GetCharacterColumn(coord.mLine, cindex)));
@@ -1641,6 +2183,28 @@ void TextEditor::SetReadOnly(const bool aValue)
 void TextEditor::SetColorizerEnable(const bool aValue)
 {
     mColorizerEnabled = aValue;
+    mPaletteAlpha = -1.0f;
+}
+
+void TextEditor::SetColorizeThreadCount(const int aValue)
+{
+    mColorizeThreadCount = std::max(1, aValue);
+}
+
+void TextEditor::SetColorizeInBackground(const bool aValue)
+{
+    mColorizeInBackground = aValue;
+
+    // The thread is started by the first job
+    if (!aValue && mColorizer.mThread != nullptr)
+    {
+        mColorizer.mThread->Wait();
+        if (const std::unique_ptr<ColorizeJob> job = mColorizer.mThread->TakeFinished())
+        {
+            ApplyColorizeJob(*job);
+        }
+        mColorizer.mThread.reset();
+    }
 }
 
 void TextEditor::SetCursorPosition(const Coordinates &aPosition)
@@ -1713,9 +2277,48 @@ void TextEditor::SetSelection(const Coordinates &aStart, const Coordinates &aEnd
     }
 }
 
+void TextEditor::SetMonospace(const bool aValue)
+{
+    if (aValue != mMonospace)
+    {
+        mMonospace = aValue;
+        ++mLayoutKey;
+    }
+}
+
+void TextEditor::SetWordWrap(const bool aValue)
+{
+    if (aValue != mWordWrap)
+    {
+        // The rows are counted from the next frame on, the top line stays
+        mWordWrap = aValue;
+        mLines.ResetRows();
+        mWrapRanges.clear();
+        mWrapLayoutKey = 0;
+        mTopRow = 0;
+        ++mMeshKey;
+        mWidthKey = 0;
+    }
+}
+
+void TextEditor::SetShowMinimap(const bool aValue)
+{
+    if (aValue != mShowMinimap)
+    {
+        // The tiles are built when drawn, and only kept while shown
+        mShowMinimap = aValue;
+        mMinimap = Minimap();
+    }
+}
+
 void TextEditor::SetTabSize(const int aValue)
 {
-    mTabSize = std::max(0, std::min(32, aValue));
+    const int tabSize = std::max(0, std::min(32, aValue));
+    if (tabSize != mTabSize)
+    {
+        mTabSize = tabSize;
+        ++mLayoutKey;
+    }
 }
 
 void TextEditor::InsertText(const std::string &aValue)
@@ -1760,7 +2363,13 @@ void TextEditor::DeleteSelection()
 void TextEditor::MoveUp(const int aAmount, const bool aSelect)
 {
     const Coordinates oldPos = mState.mCursorPosition;
-    mState.mCursorPosition.mLine = std::max(0, mState.mCursorPosition.mLine - aAmount);
+    if (mWordWrap && HasGlyphAdvances())
+    {
+        mState.mCursorPosition = MoveRows(oldPos, -aAmount);
+    } else
+    {
+        mState.mCursorPosition.mLine = std::max(0, mState.mCursorPosition.mLine - aAmount);
+    }
     if (oldPos != mState.mCursorPosition)
     {
         if (aSelect)
@@ -1790,9 +2399,15 @@ void TextEditor::MoveDown(const int aAmount, const bool aSelect)
 {
     assert(mState.mCursorPosition.mColumn >= 0);
     const Coordinates oldPos = mState.mCursorPosition;
-    mState.mCursorPosition.mLine = std::max(0,
-                                            std::min(static_cast<int>(mLines.size()) - 1,
-                                                     mState.mCursorPosition.mLine + aAmount));
+    if (mWordWrap && HasGlyphAdvances())
+    {
+        mState.mCursorPosition = MoveRows(oldPos, aAmount);
+    } else
+    {
+        mState.mCursorPosition.mLine = std::max(0,
+                                                std::min(static_cast<int>(mLines.size()) - 1,
+                                                         mState.mCursorPosition.mLine + aAmount));
+    }
 
     if (mState.mCursorPosition != oldPos)
     {
@@ -1819,9 +2434,24 @@ void TextEditor::MoveDown(const int aAmount, const bool aSelect)
     }
 }
 
-static bool IsUTFSequence(const char c)
+// The position aRows screen rows below aFrom, or above it if negative, as close to the same x as the
+// row allows
+Coordinates TextEditor::MoveRows(const Coordinates &aFrom, const int aRows) const
 {
-    return (c & 0xC0) == 0x80;
+    const Coordinates from = SanitizeCoordinates(aFrom);
+    const std::vector<uint32_t> &wraps = GetLineWraps(from.mLine);
+    const std::vector<float> &layout = GetLineLayout(from.mLine);
+    const int index = GetCharacterIndex(from);
+    const size_t row = FindRow(wraps, index);
+    const float x = layout.at(index) - (row > 0 ? layout.at(wraps.at(row - 1)) : 0.0f);
+
+    const int64_t target = std::clamp(static_cast<int64_t>(GetLineRow(from.mLine)) + static_cast<int64_t>(row) + aRows,
+                                      static_cast<int64_t>(0),
+                                      static_cast<int64_t>(mLines.rows()) - 1);
+    size_t subRow = 0;
+    const int line = static_cast<int>(mLines.LineAtRow(static_cast<size_t>(target), subRow));
+    // A line not wrapped again yet may have fewer rows than it is counted with
+    return GetRowCoordinates(line, static_cast<int>(std::min(subRow, GetLineWraps(line).size())), x);
 }
 
 void TextEditor::MoveLeft(int aAmount, const bool aSelect, const bool aWordMode)
@@ -1858,7 +2488,7 @@ void TextEditor::MoveLeft(int aAmount, const bool aSelect, const bool aWordMode)
             {
                 if (static_cast<int>(mLines.size()) > line)
                 {
-                    while (cindex > 0 && IsUTFSequence(mLines.at(line).at(cindex).mChar))
+                    while (cindex > 0 && IsUTFSequence(mLines.at(line).GetChar(cindex)))
                     {
                         --cindex;
                     }
@@ -1914,7 +2544,7 @@ void TextEditor::MoveRight(int aAmount, const bool aSelect, const bool aWordMode
     while (aAmount-- > 0)
     {
         const int lindex = mState.mCursorPosition.mLine;
-        std::vector<Glyph> &line = mLines.at(lindex);
+        Line &line = mLines.at(lindex);
 
         if (static_cast<size_t>(cindex) >= line.size())
         {
@@ -1930,7 +2560,7 @@ void TextEditor::MoveRight(int aAmount, const bool aSelect, const bool aWordMode
             }
         } else
         {
-            cindex += UTF8CharLength(line.at(cindex).mChar);
+            cindex += UTF8CharLength(line.GetChar(cindex));
             mState.mCursorPosition = Coordinates(lindex, GetCharacterColumn(lindex, cindex));
             if (aWordMode)
             {
@@ -2077,7 +2707,7 @@ void TextEditor::Delete()
     {
         const Coordinates pos = GetActualCursorCoordinates();
         SetCursorPosition(pos);
-        std::vector<Glyph> &line = mLines.at(pos.mLine);
+        Line &line = mLines.at(pos.mLine);
 
         if (pos.mColumn == GetLineMaxColumn(pos.mLine))
         {
@@ -2090,8 +2720,8 @@ void TextEditor::Delete()
             u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
             Advance(u.mRemovedEnd);
 
-            std::vector<Glyph> &nextLine = mLines.at(pos.mLine + 1);
-            line.insert(line.end(), nextLine.begin(), nextLine.end());
+            Line &nextLine = mLines.at(pos.mLine + 1);
+            line.append(nextLine);
             RemoveLine(pos.mLine + 1);
         } else
         {
@@ -2100,10 +2730,10 @@ void TextEditor::Delete()
             u.mRemovedEnd.mColumn++;
             u.mRemoved = GetText(u.mRemovedStart, u.mRemovedEnd);
 
-            int d = UTF8CharLength(line.at(cindex).mChar);
+            int d = UTF8CharLength(line.GetChar(cindex));
             while (d-- > 0 && cindex < static_cast<int>(line.size()))
             {
-                line.erase(line.begin() + cindex);
+                line.erase(cindex, cindex + 1);
             }
         }
 
@@ -2151,10 +2781,10 @@ void TextEditor::Backspace()
             u.mRemovedStart = u.mRemovedEnd = Coordinates(pos.mLine - 1, GetLineMaxColumn(pos.mLine - 1));
             Advance(u.mRemovedEnd);
 
-            std::vector<Glyph> &line = mLines.at(mState.mCursorPosition.mLine);
-            std::vector<Glyph> &prevLine = mLines.at(mState.mCursorPosition.mLine - 1);
+            Line &line = mLines.at(mState.mCursorPosition.mLine);
+            Line &prevLine = mLines.at(mState.mCursorPosition.mLine - 1);
             const int prevSize = GetLineMaxColumn(mState.mCursorPosition.mLine - 1);
-            prevLine.insert(prevLine.end(), line.begin(), line.end());
+            prevLine.append(line);
 
             ErrorMarkers etmp;
             for (const std::pair<const int, std::string> &i: mErrorMarkers)
@@ -2170,10 +2800,10 @@ void TextEditor::Backspace()
             mState.mCursorPosition.mColumn = prevSize;
         } else
         {
-            std::vector<Glyph> &line = mLines.at(mState.mCursorPosition.mLine);
+            Line &line = mLines.at(mState.mCursorPosition.mLine);
             int cindex = GetCharacterIndex(pos) - 1;
             int cend = cindex + 1;
-            while (cindex > 0 && IsUTFSequence(line.at(cindex).mChar))
+            while (cindex > 0 && IsUTFSequence(line.GetChar(cindex)))
             {
                 --cindex;
             }
@@ -2187,8 +2817,8 @@ void TextEditor::Backspace()
 
             while (static_cast<size_t>(cindex) < line.size() && cend-- > cindex)
             {
-                u.mRemoved += line.at(cindex).mChar;
-                line.erase(line.begin() + cindex);
+                u.mRemoved += line.GetChar(cindex);
+                line.erase(cindex, cindex + 1);
             }
         }
 
@@ -2227,12 +2857,9 @@ void TextEditor::Copy() const
     {
         if (!mLines.empty())
         {
+            const Line &line = mLines.at(GetActualCursorCoordinates().mLine);
             std::string str;
-            const std::vector<Glyph> &line = mLines.at(GetActualCursorCoordinates().mLine);
-            for (const Glyph &g: line)
-            {
-                str.push_back(g.mChar);
-            }
+            line.AppendChars(str, 0, line.size());
             ImGui::SetClipboardText(str.c_str());
         }
     }
@@ -2331,18 +2958,9 @@ std::vector<std::string> TextEditor::GetTextLines() const
 
     result.reserve(mLines.size());
 
-    for (const std::vector<Glyph> &line: mLines)
+    for (const Line &line: mLines)
     {
-        std::string text;
-
-        text.resize(line.size());
-
-        for (size_t i = 0; i < line.size(); ++i)
-        {
-            text.at(i) = line.at(i).mChar;
-        }
-
-        result.emplace_back(std::move(text));
+        line.AppendChars(result.emplace_back(), 0, line.size());
     }
 
     return result;
@@ -2363,330 +2981,1557 @@ void TextEditor::Colorize(const int aFromLine, const int aLines)
 {
     const int toLine = aLines == -1 ? static_cast<int>(mLines.size())
                                     : std::min(static_cast<int>(mLines.size()), aFromLine + aLines);
-    mColorRangeMin = std::min(mColorRangeMin, aFromLine);
-    mColorRangeMax = std::max(mColorRangeMax, toLine);
-    mColorRangeMin = std::max(0, mColorRangeMin);
-    mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
-    mCheckComments = true;
+    mColorRanges.Add(std::max(0, aFromLine), toLine);
+    mWidthRanges.Add(std::max(0, aFromLine), toLine);
+    mWrapRanges.Add(std::max(0, aFromLine), toLine);
+    mMinimap.mRanges.Add(std::max(0, aFromLine), toLine);
+    InvalidateScan(aFromLine, toLine);
+}
+
+void TextEditor::InvalidateScan(const int aFromLine, const int aToLine)
+{
+    mScanRanges.Add(std::max(0, aFromLine), std::min(static_cast<int>(mLines.size()), aToLine));
+    mColorizer.Invalidate(std::max(0, aFromLine), std::min(static_cast<int>(mLines.size()), aToLine));
+    ++mDocumentVersion;
 }
 
 void TextEditor::ColorizeRange(const int aFromLine, const int aToLine)
 {
-    if (mLines.empty() || aFromLine >= aToLine)
+    const int endLine = std::min(static_cast<int>(mLines.size()), aToLine);
+    if (aFromLine >= endLine)
     {
         return;
     }
 
-    std::string buffer;
-    std::cmatch results;
-    std::string id;
+    Lines::iterator lineIt = mLines.IteratorAt(aFromLine);
+    for (int i = aFromLine; i < endLine; ++i, ++lineIt)
+    {
+        ColorizeLine(*lineIt);
+    }
+    mMinimap.mRanges.Add(aFromLine, endLine);
+}
 
-    const int endLine = std::max(0, std::min(static_cast<int>(mLines.size()), aToLine));
-    for (int i = aFromLine; i < endLine; ++i)
+// Only reads the language definition, so it may run on the colorizer thread
+void TextEditor::ColorizeLine(Line &aLine) const
+{
+    if (aLine.empty())
     {
-        std::vector<Glyph> &line = mLines.at(i);
+        aLine.UpdateStyleRuns();
+        return;
+    }
 
-        if (line.empty())
-        {
-            continue;
-        }
+    aLine.FillColor(0, aLine.size(), PaletteIndex::Default);
 
-        buffer.resize(line.size());
-        for (size_t j = 0; j < line.size(); ++j)
-        {
-            Glyph &col = line.at(j);
-            buffer.at(j) = col.mChar;
-            col.mColorIndex = PaletteIndex::Default;
-        }
+    // Tokenize straight from the line's byte plane, or across its gap, without moving it
+    if (const char *chars = aLine.CharRange(0, aLine.size()); chars != nullptr)
+    {
+        TokenizeLine(aLine, chars, chars + aLine.size(), mLanguageDefinition.mTokenize);
+    } else if (mLanguageDefinition.mTokenizeLine != nullptr || mLanguageDefinition.mTokenize == nullptr)
+    {
+        TokenizeLine(aLine, aLine.begin(), aLine.end(), mLanguageDefinition.mTokenizeLine);
+    } else
+    {
+        // A tokenizer that only takes pointers gets a copy of the text
+        std::string text;
+        aLine.AppendChars(text, 0, aLine.size());
+        TokenizeLine(aLine, text.c_str(), text.c_str() + text.size(), mLanguageDefinition.mTokenize);
+    }
 
-        const char *bufferBegin = &buffer.front();
-        const char *bufferEnd = bufferBegin + buffer.size();
+    aLine.UpdateStyleRuns();
+}
 
-        const char *last = bufferEnd;
+// Colors aLine by the tokens found in its bytes [aBegin, aEnd) with aTokenize, the DFA or the regexes
+template<typename CharIterator, typename TokenizeFunction>
+void TextEditor::TokenizeLine(Line &aLine, const CharIterator aBegin, const CharIterator aEnd, const TokenizeFunction aTokenize) const
+{
+    std::match_results<CharIterator> results;
+    std::string id;
 
-        for (const char *first = bufferBegin; first != last;)
-        {
-            const char *token_begin = nullptr;
-            const char *token_end = nullptr;
-            PaletteIndex token_color = PaletteIndex::Default;
+    for (CharIterator first = aBegin; first != aEnd;)
+    {
+        CharIterator token_begin{};
+        CharIterator token_end{};
+        PaletteIndex token_color = PaletteIndex::Default;
 
-            bool hasTokenizeResult = false;
+        bool hasTokenizeResult = false;
 
-            if (mLanguageDefinition.mTokenize != nullptr)
+        if (aTokenize != nullptr)
+        {
+            if (aTokenize(first, aEnd, token_begin, token_end, token_color))
             {
-                if (mLanguageDefinition.mTokenize(first, last, token_begin, token_end, token_color))
-                {
-                    hasTokenizeResult = true;
-                }
+                hasTokenizeResult = true;
             }
+        }
 
-            if (!hasTokenizeResult)
+        if (!hasTokenizeResult && mRegexDFA.IsValid())
+        {
+            if (mRegexDFA.Match(first, aEnd, token_end, token_color))
             {
-                // todo : remove
-                //printf("using regex for %.*s\n", first + 10 < last ? 10 : int(last - first), first);
-
-                for (const std::pair<std::regex, PaletteIndex> &p: mRegexList)
+                hasTokenizeResult = true;
+                token_begin = first;
+            }
+        } else if (!hasTokenizeResult)
+        {
+            for (const std::pair<std::regex, PaletteIndex> &p: mRegexList)
+            {
+                if (std::regex_search(first, aEnd, results, p.first, std::regex_constants::match_continuous))
                 {
-                    if (std::regex_search(first, last, results, p.first, std::regex_constants::match_continuous))
-                    {
-                        hasTokenizeResult = true;
+                    hasTokenizeResult = true;
 
-                        const std::sub_match<const char *> &v = *results.begin();
-                        token_begin = v.first;
-                        token_end = v.second;
-                        token_color = p.second;
-                        break;
-                    }
+                    const std::sub_match<CharIterator> &v = *results.begin();
+                    token_begin = v.first;
+                    token_end = v.second;
+                    token_color = p.second;
+                    break;
                 }
             }
+        }
 
-            if (!hasTokenizeResult)
-            {
-                first++;
-            } else
+        if (!hasTokenizeResult)
+        {
+            first++;
+        } else
+        {
+            if (token_color == PaletteIndex::Identifier)
             {
-                const size_t token_length = token_end - token_begin;
+                id.assign(token_begin, token_end);
 
-                if (token_color == PaletteIndex::Identifier)
+                // todo : almost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
+                if (!mLanguageDefinition.mCaseSensitive)
                 {
-                    id.assign(token_begin, token_end);
+                    std::ranges::transform(id, id.begin(), ::toupper);
+                }
 
-                    // todo : almost all language definitions use lower case to specify keywords, so shouldn't this use ::tolower ?
-                    if (!mLanguageDefinition.mCaseSensitive)
+                if (!aLine.HasFlag(first - aBegin, GlyphFlag::Preprocessor))
+                {
+                    if (mLanguageDefinition.mKeywords.contains(id))
+                    {
+                        token_color = PaletteIndex::Keyword;
+                    } else if (mLanguageDefinition.mIdentifiers.contains(id))
+                    {
+                        token_color = PaletteIndex::KnownIdentifier;
+                    } else if (mLanguageDefinition.mPreprocIdentifiers.contains(id))
                     {
-                        std::ranges::transform(id, id.begin(), ::toupper);
+                        token_color = PaletteIndex::PreprocIdentifier;
                     }
+                } else
+                {
+                    if (mLanguageDefinition.mPreprocIdentifiers.contains(id))
+                    {
+                        token_color = PaletteIndex::PreprocIdentifier;
+                    }
+                }
+            }
+
+            aLine.FillColor(token_begin - aBegin, token_end - aBegin, token_color);
+
+            first = token_end;
+        }
+    }
+}
+
+void TextEditor::ColorizeInternal()
+{
+    if (mLines.empty() || !mColorizerEnabled)
+    {
+        return;
+    }
+
+    if (mColorizeInBackground)
+    {
+        SubmitColorizeJob();
+        return;
+    }
+
+    // Minimum number of lines worth giving a thread of its own
+    constexpr int minLinesPerThread = 4096;
+    const int lineCount = static_cast<int>(mLines.size());
+    const int threadCount = std::min(mColorizeThreadCount, lineCount / minLinesPerThread);
+    if (threadCount > 1 && mScanRanges.Contains(0, lineCount) && mColorRanges.Contains(0, lineCount))
+    {
+        ColorizeDocumentParallel(threadCount);
+        return;
+    }
+
+    if (mColorizeTimeBudget <= 0)
+    {
+        if (!mScanRanges.empty())
+        {
+            ScanComments(std::numeric_limits<int>::max());
+        }
+        ColorizeQueuedLines(0, lineCount, GetColorizeIncrement());
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(mColorizeTimeBudget);
+
+    // Lines are checked against the deadline in batches that take roughly the same time
+    constexpr int scanBatch = 1000;
+    const int colorBatch = std::max(1, GetColorizeIncrement() / 100);
+
+    ColorizeVisibleLines(deadline);
+    while (!mScanRanges.empty() && Clock::now() < deadline)
+    {
+        ScanComments(scanBatch);
+    }
+    while (Clock::now() < deadline && ColorizeQueuedLines(0, lineCount, colorBatch) > 0)
+    {
+    }
+}
+
+// Tokenizes the queued lines on screen, then a screenful below and above them, until aDeadline
+void TextEditor::ColorizeVisibleLines(const std::chrono::steady_clock::time_point &aDeadline)
+{
+    // Nothing has been rendered yet
+    if (mCharAdvance.y <= 0.0f || mColorRanges.empty())
+    {
+        return;
+    }
+
+    const int lineCount = static_cast<int>(mLines.size());
+    const int visibleCount = static_cast<int>(ceil(ImGui::GetWindowHeight() / mCharAdvance.y)) + 1;
+    const int firstVisible = std::min(lineCount, mTopLine);
+    const int from = std::max(0, firstVisible - visibleCount);
+    const int to = std::min(lineCount, firstVisible + 2 * visibleCount);
+
+    const int batch = std::max(1, GetColorizeIncrement() / 100);
+    while (std::chrono::steady_clock::now() < aDeadline && ColorizeQueuedLines(firstVisible, to, batch) > 0)
+    {
+    }
+    while (std::chrono::steady_clock::now() < aDeadline && ColorizeQueuedLines(from, firstVisible, batch) > 0)
+    {
+    }
+}
+
+// Tokenizes up to aMaxLines of the queued lines within [aFromLine, aToLine), first ones first, and
+// returns how many it did
+int TextEditor::ColorizeQueuedLines(const int aFromLine, const int aToLine, const int aMaxLines)
+{
+    int count = 0;
+    while (count < aMaxLines)
+    {
+        const LineRanges::Range range = mColorRanges.First(aFromLine, aToLine);
+        if (range.empty())
+        {
+            break;
+        }
+        const int to = range.mFrom + std::min(range.mTo - range.mFrom, aMaxLines - count);
+        ColorizeRange(range.mFrom, to);
+        mColorRanges.Remove(range.mFrom, to);
+        count += to - range.mFrom;
+    }
+    return count;
+}
+
+// Bits of the comment/preprocessor scanner state saved at the start of each line. The last
+// three only carry over a '\' line continuation and are left clear otherwise.
+static constexpr uint8_t kScanBlockComment = 1 << 0;
+static constexpr uint8_t kScanString = 1 << 1;
+static constexpr uint8_t kScanConcatenate = 1 << 2;
+static constexpr uint8_t kScanSingleLineComment = 1 << 3;
+static constexpr uint8_t kScanPreprocessor = 1 << 4;
+static constexpr uint8_t kScanFirstChar = 1 << 5;
+
+// Rescans at most aMaxLines lines from the first dirty range on, leaving the rest queued. Lines
+// whose preprocessor flags change are queued for tokenizing.
+void TextEditor::ScanComments(const int aMaxLines)
+{
+    const int lineCount = static_cast<int>(mLines.size());
+    const LineRanges::Range range = mScanRanges.First();
+    const int fromLine = FindScanStart(std::min(range.mFrom, lineCount - 1));
+    // At least two lines, so that resuming from the last one still makes progress
+    const int endLine = fromLine + std::min(lineCount - fromLine, std::max(2, aMaxLines));
+
+    const int stopLine = ScanLineRun(mLines.IteratorAt(fromLine),
+                                     mLines.IteratorAt(endLine),
+                                     fromLine,
+                                     std::min(range.mTo, lineCount),
+                                     &mColorRanges);
+    mScanRanges.Remove(fromLine, stopLine);
+    mMinimap.mRanges.Add(fromLine, stopLine);
+
+    // The state the last line ends in is only stored on the next line by scanning it
+    if (stopLine == endLine && endLine < lineCount)
+    {
+        mScanRanges.Add(endLine - 1, endLine);
+    }
+}
+
+// The closest line at or before aLine whose start state is known
+int TextEditor::FindScanStart(int aLine) const
+{
+    Lines::const_iterator lineIt = mLines.IteratorAt(aLine);
+    while (aLine > 0 && lineIt->GetScanState() == Line::kUnknownScanState)
+    {
+        --aLine;
+        --lineIt;
+    }
+    return aLine;
+}
+
+// Scans the lines [aBegin, aEnd), the first being line aFirstLine whose start state is known, until
+// a line at or past aToLine keeps its saved start state. Returns the index of that line, or of the
+// line following the run if it ended first. Lines whose preprocessor flags changed, and so have to be
+// tokenized again, are added to aRetokenize unless it is null.
+template<typename LineIterator>
+int TextEditor::ScanLineRun(LineIterator aBegin,
+                            const LineIterator aEnd,
+                            const int aFirstLine,
+                            const int aToLine,
+                            LineRanges *aRetokenize) const
+{
+    uint8_t state = aFirstLine == 0 ? 0 : aBegin->GetScanState();
+    int currentLine = aFirstLine;
+    for (LineIterator lineIt = aBegin; lineIt != aEnd; ++lineIt, ++currentLine)
+    {
+        Line &line = *lineIt;
+        if (currentLine > aFirstLine && currentLine >= aToLine && line.GetScanState() == state)
+        {
+            break;
+        }
+        line.SetScanState(state);
+        bool preprocessorChanged = false;
+        state = ScanLine(line, state, preprocessorChanged);
+        if (preprocessorChanged && aRetokenize != nullptr)
+        {
+            aRetokenize->Add(currentLine, currentLine + 1);
+        }
+    }
+    return currentLine;
+}
+
+uint8_t TextEditor::ScanLine(Line &aLine, const uint8_t aState, bool &aPreprocessorChanged) const
+{
+    constexpr int noComment = std::numeric_limits<int>::max();
+
+    // index the current block comment started at, -1 if it was opened on a previous line
+    int commentStartIndex = (aState & kScanBlockComment) != 0 ? -1 : noComment;
+    bool withinString = (aState & kScanString) != 0;
+    bool concatenate = (aState & kScanConcatenate) != 0; // '\' on the very end of the line
+    bool withinSingleLineComment = concatenate && (aState & kScanSingleLineComment) != 0;
+    bool withinPreproc = concatenate && (aState & kScanPreprocessor) != 0;
+    // there is no other non-whitespace characters in the line before
+    bool firstChar = !concatenate || (aState & kScanFirstChar) != 0;
+    concatenate = false;
+    bool flagsChanged = false;
+
+    const int size = static_cast<int>(aLine.size());
+    for (int currentIndex = 0; currentIndex < size;)
+    {
+        concatenate = false;
+
+        const Char c = aLine.GetChar(currentIndex);
+
+        if (c != mLanguageDefinition.mPreprocChar && (isspace(c) == 0))
+        {
+            firstChar = false;
+        }
+
+        if (currentIndex == size - 1 && c == '\\')
+        {
+            concatenate = true;
+        }
+
+        const int glyphIndex = currentIndex;
+        bool inComment = commentStartIndex <= currentIndex;
+
+        if (withinString)
+        {
+            if (c == '\"')
+            {
+                if (currentIndex + 1 < size && aLine.GetChar(currentIndex + 1) == '\"')
+                {
+                    currentIndex += 1;
+                } else
+                {
+                    withinString = false;
+                }
+            } else if (c == '\\')
+            {
+                currentIndex += 1;
+            }
+        } else
+        {
+            if (firstChar && c == mLanguageDefinition.mPreprocChar)
+            {
+                withinPreproc = true;
+            }
+
+            if (c == '\"')
+            {
+                withinString = true;
+            } else
+            {
+                auto pred = [](const char &a, const char &b) {
+                    return a == b;
+                };
+                const Line::CharIterator from = aLine.begin() + currentIndex;
+                const std::string &startStr = mLanguageDefinition.mCommentStart;
+                const std::string &singleStartStr = mLanguageDefinition.mSingleLineComment;
+
+                if (!singleStartStr.empty() &&
+                    currentIndex + singleStartStr.size() <= static_cast<size_t>(size) &&
+                    equals(singleStartStr.begin(), singleStartStr.end(), from, from + singleStartStr.size(), pred))
+                {
+                    withinSingleLineComment = true;
+                } else if (!withinSingleLineComment &&
+                           currentIndex + startStr.size() <= static_cast<size_t>(size) &&
+                           equals(startStr.begin(), startStr.end(), from, from + startStr.size(), pred))
+                {
+                    commentStartIndex = currentIndex;
+                }
+
+                inComment = commentStartIndex <= currentIndex;
+
+                const std::string &endStr = mLanguageDefinition.mCommentEnd;
+                if (currentIndex + 1 >= static_cast<int>(endStr.size()) &&
+                    equals(endStr.begin(), endStr.end(), from + 1 - endStr.size(), from + 1, pred))
+                {
+                    commentStartIndex = noComment;
+                }
+            }
+        }
+
+        // Every byte of the glyph, and of an escaped or doubled quote following it inside a
+        // string, gets all three flags so that none are left over from an earlier scan
+        const int next = std::min(size, currentIndex + UTF8CharLength(c));
+        for (int i = glyphIndex; i < next; ++i)
+        {
+            const uint8_t flags = aLine.GetFlags(i);
+            aPreprocessorChanged |= aLine.HasFlag(i, GlyphFlag::Preprocessor) != withinPreproc;
+            aLine.SetFlag(i, GlyphFlag::MultiLineComment, inComment);
+            aLine.SetFlag(i, GlyphFlag::Comment, withinSingleLineComment);
+            aLine.SetFlag(i, GlyphFlag::Preprocessor, withinPreproc);
+            flagsChanged |= aLine.GetFlags(i) != flags;
+        }
+        currentIndex = next;
+    }
+
+    if (flagsChanged || !aLine.HasStyleRuns())
+    {
+        aLine.UpdateStyleRuns();
+    }
+
+    uint8_t state = 0;
+    if (commentStartIndex != noComment)
+    {
+        state |= kScanBlockComment;
+    }
+    if (withinString)
+    {
+        state |= kScanString;
+    }
+    if (concatenate)
+    {
+        state |= kScanConcatenate;
+        state |= withinSingleLineComment ? kScanSingleLineComment : 0;
+        state |= withinPreproc ? kScanPreprocessor : 0;
+        state |= firstChar ? kScanFirstChar : 0;
+    }
+    return state;
+}
+
+// Scans and tokenizes the whole document with one thread per chunk of lines. Each chunk is scanned
+// as if it started outside of any comment or string; a sequential pass then rescans (and
+// retokenizes) from every chunk boundary where that guess was wrong, until the state settles.
+void TextEditor::ColorizeDocumentParallel(const int aThreadCount)
+{
+    const int lineCount = static_cast<int>(mLines.size());
+
+    std::vector<int> chunkStarts;
+    std::vector<Lines::iterator> chunkBegins;
+    for (int i = 0; i <= aThreadCount; ++i)
+    {
+        const int start = static_cast<int>(static_cast<int64_t>(lineCount) * i / aThreadCount);
+        chunkStarts.push_back(start);
+        chunkBegins.push_back(mLines.IteratorAt(start));
+        if (i < aThreadCount)
+        {
+            chunkBegins.back()->SetScanState(0);
+        }
+    }
+
+    // Threads only touch the lines of their own chunk; the tree itself is not modified
+    std::vector<std::thread> threads;
+    threads.reserve(aThreadCount);
+    for (int i = 0; i < aThreadCount; ++i)
+    {
+        threads.emplace_back([this, &chunkStarts, &chunkBegins, i] {
+            ScanLineRun(chunkBegins.at(i), chunkBegins.at(i + 1), chunkStarts.at(i), chunkStarts.at(i + 1), nullptr);
+            for (Lines::iterator lineIt = chunkBegins.at(i); lineIt != chunkBegins.at(i + 1); ++lineIt)
+            {
+                ColorizeLine(*lineIt);
+            }
+        });
+    }
+    for (std::thread &thread: threads)
+    {
+        thread.join();
+    }
+
+    // Fix up the chunk boundaries in order: rescanning from the last line of the previous chunk stops
+    // right at the boundary if the guessed start state was right
+    LineRanges retokenize;
+    int fixedUpTo = 0;
+    for (int i = 1; i < aThreadCount; ++i)
+    {
+        const int boundary = chunkStarts.at(i);
+        if (fixedUpTo > boundary)
+        {
+            continue;
+        }
+        fixedUpTo = ScanLineRun(mLines.IteratorAt(boundary - 1), mLines.end(), boundary - 1, boundary, &retokenize);
+    }
+    for (const LineRanges::Range &range: retokenize)
+    {
+        ColorizeRange(range.mFrom, range.mTo);
+    }
+
+    mScanRanges.clear();
+    mColorRanges.clear();
+    mMinimap.mRanges.Add(0, lineCount);
+}
+
+int TextEditor::GetColorizeIncrement() const
+{
+    return (mLanguageDefinition.mTokenize == nullptr && !mRegexDFA.IsValid()) ? 10 : 10000;
+}
+
+// Hands the next chunk of pending work to the colorizer thread, comment scanning first. Only the
+// lines queued for scanning or tokenizing are copied, along with the lines the scan may run into. The
+// work stays queued until the job's results are applied.
+void TextEditor::SubmitColorizeJob()
+{
+    const bool scan = !mScanRanges.empty();
+    if (!scan && mColorRanges.empty())
+    {
+        return;
+    }
+    if (mColorizer.mThread == nullptr)
+    {
+        mColorizer.mThread = std::make_unique<ColorizerThread>([this](ColorizeJob &aJob) {
+            RunColorizeJob(aJob);
+        });
+    } else if (mColorizer.mThread->IsBusy())
+    {
+        return;
+    }
+
+    const int lineCount = static_cast<int>(mLines.size());
+    const int first = scan ? FindScanStart(std::min(mScanRanges.First().mFrom, lineCount - 1)) : mColorRanges.First().mFrom;
+    const int last = std::min(lineCount, first + GetColorizeIncrement());
+
+    std::unique_ptr<ColorizeJob> job = std::make_unique<ColorizeJob>();
+    job->mLineCount = lineCount;
+
+    if (scan)
+    {
+        job->mScanFrom = first;
+        job->mScanTo = std::min(mScanRanges.First().mTo, lineCount);
+        job->mScanEnd = std::min(last, job->mScanTo + mColorizeLookahead);
+        Lines::iterator lineIt = mLines.IteratorAt(first);
+        for (int i = first; i < job->mScanEnd; ++i, ++lineIt)
+        {
+            job->mLines.push_back(lineIt->CopyPlanes());
+            job->mLineIndices.push_back(i);
+        }
+    }
+
+    for (LineRanges::Range range = mColorRanges.First(first, last); !range.empty();
+         range = mColorRanges.First(range.mTo, last))
+    {
+        job->mColorRanges.Add(range.mFrom, range.mTo);
+
+        const int from = std::max(range.mFrom, job->mScanEnd);
+        if (from < range.mTo)
+        {
+            Lines::iterator lineIt = mLines.IteratorAt(from);
+            for (int i = from; i < range.mTo; ++i, ++lineIt)
+            {
+                job->mLines.push_back(lineIt->CopyPlanes());
+                job->mLineIndices.push_back(i);
+            }
+        }
+    }
+
+    mColorizer.mShifts.clear();
+    mColorizer.mEdited.clear();
+    mColorizer.mReplaced = false;
+    mColorizer.mThread->Submit(std::move(job));
+}
+
+// Runs on the colorizer thread
+void TextEditor::RunColorizeJob(ColorizeJob &aJob) const
+{
+    if (aJob.mScanFrom < aJob.mScanTo)
+    {
+        const std::vector<Line>::iterator begin = aJob.mLines.begin();
+        aJob.mScanStop = ScanLineRun(begin, begin + (aJob.mScanEnd - aJob.mScanFrom), aJob.mScanFrom, aJob.mScanTo, &aJob.mColorRanges);
+    }
+
+    for (size_t i = 0; i < aJob.mLines.size(); ++i)
+    {
+        if (aJob.mColorRanges.Contains(aJob.mLineIndices.at(i)))
+        {
+            ColorizeLine(aJob.mLines.at(i));
+        }
+    }
+}
+
+void TextEditor::ApplyColorizeJob(const ColorizeJob &aJob)
+{
+    // Lines edited in the meantime have been queued again and are left alone. Of the others, only those
+    // whose styles changed are written back, so that the rest keep their meshes.
+    assert(!aJob.mLines.empty());
+    const int lineCount = static_cast<int>(mLines.size());
+
+    // The recorded edits account for every line inserted or erased since the lines were copied
+    int movedLineCount = aJob.mLineCount;
+    for (const Colorizer::Shift &shift: mColorizer.mShifts)
+    {
+        movedLineCount += shift.mCount;
+    }
+    assert(mColorizer.mReplaced || movedLineCount == lineCount);
+    (void)movedLineCount;
+    LineRanges colorized;
+    LineRanges scanned;
+    int lastScanned = -1;
+    Lines::iterator lineIt = mLines.begin();
+    int previous = -1;
+    for (size_t i = 0; i < aJob.mLines.size(); ++i)
+    {
+        const int jobIndex = aJob.mLineIndices.at(i);
+        const int index = mColorizer.FindLine(jobIndex);
+        if (index < 0 || index >= lineCount)
+        {
+            continue;
+        }
+        lineIt = previous >= 0 && index == previous + 1 ? std::next(lineIt) : mLines.IteratorAt(index);
+        previous = index;
+
+        Line &line = *lineIt;
+        const Line &result = aJob.mLines.at(i);
+        assert(line.size() == result.size());
+        line.SetScanState(result.GetScanState());
+        if (result.HasStyleRuns() && (!line.HasStyleRuns() || !line.HasSameStyle(result)))
+        {
+            line.CopyStyle(result);
+            mMinimap.mRanges.Add(index, index + 1);
+        }
+
+        if (aJob.mColorRanges.Contains(jobIndex))
+        {
+            colorized.Add(index, index + 1);
+        }
+        if (jobIndex >= aJob.mScanFrom && jobIndex < aJob.mScanStop)
+        {
+            scanned.Add(index, index + 1);
+            lastScanned = index;
+        }
+    }
+
+    for (const LineRanges::Range &range: colorized)
+    {
+        mColorRanges.Remove(range.mFrom, range.mTo);
+    }
+
+    if (aJob.mScanFrom < aJob.mScanTo)
+    {
+        for (const LineRanges::Range &range: scanned)
+        {
+            mScanRanges.Remove(range.mFrom, range.mTo);
+        }
+
+        // The comment state was still changing at the end of the copied run. The state its last line
+        // ends in is only stored on the next line by scanning it; the next job copies more lines.
+        if (aJob.mScanStop == aJob.mScanEnd && aJob.mScanEnd < aJob.mLineCount)
+        {
+            if (lastScanned >= 0)
+            {
+                mScanRanges.Add(lastScanned, lastScanned + 1);
+            }
+            mColorizeLookahead = std::min(mColorizeLookahead * 2, GetColorizeIncrement());
+        } else
+        {
+            mColorizeLookahead = kColorizeLookahead;
+        }
+    }
+}
+
+void TextEditor::Colorizer::InsertLines(const int aIndex, const int aCount)
+{
+    if (mThread != nullptr && mThread->IsBusy())
+    {
+        mShifts.push_back(Shift{aIndex, aCount});
+        mEdited.InsertLines(aIndex, aCount);
+    }
+}
+
+void TextEditor::Colorizer::EraseLines(const int aFirst, const int aLast)
+{
+    if (mThread != nullptr && mThread->IsBusy())
+    {
+        mShifts.push_back(Shift{aFirst, aFirst - aLast});
+        mEdited.EraseLines(aFirst, aLast);
+    }
+}
+
+void TextEditor::Colorizer::Invalidate(const int aFrom, const int aTo)
+{
+    if (mThread != nullptr && mThread->IsBusy())
+    {
+        mEdited.Add(aFrom, aTo);
+    }
+}
+
+void TextEditor::Colorizer::Replace()
+{
+    if (mThread != nullptr && mThread->IsBusy())
+    {
+        mReplaced = true;
+    }
+}
+
+int TextEditor::Colorizer::FindLine(const int aIndex) const
+{
+    if (mReplaced)
+    {
+        return -1;
+    }
+
+    int index = aIndex;
+    for (const Shift &shift: mShifts)
+    {
+        if (shift.mCount > 0)
+        {
+            if (index >= shift.mIndex)
+            {
+                index += shift.mCount;
+            }
+        } else if (index >= shift.mIndex - shift.mCount)
+        {
+            index += shift.mCount;
+        } else if (index >= shift.mIndex)
+        {
+            return -1;
+        }
+    }
+    return mEdited.Contains(index) ? -1 : index;
+}
+
+float TextEditor::TextDistanceToLineStart(const Coordinates &aFrom) const
+{
+    const Line &line = mLines.at(aFrom.mLine);
+    if (line.IsPrintableAscii() && IsOnGrid(line))
+    {
+        return static_cast<float>(GetCharacterIndex(aFrom)) * mGlyphAdvances->Advance('#');
+    }
+    const std::vector<float> &layout = GetLineLayout(aFrom.mLine);
+    if (IsOnGrid(line))
+    {
+        // Glyphs start at the x of their column, so the first glyph at or past the column is found by x
+        const float x = static_cast<float>(aFrom.mColumn) * mGlyphAdvances->Advance('#');
+        return *std::lower_bound(layout.begin(), layout.end() - 1, x);
+    }
+    return layout.at(std::min(layout.size() - 1, static_cast<size_t>(GetCharacterIndex(aFrom))));
+}
+
+// The line's cached layout, measured first if the text or the font, size or tab size changed
+const std::vector<float> &TextEditor::GetLineLayout(const int aLine) const
+{
+    const Line &line = mLines.at(aLine);
+    if (const std::vector<float> *cached = line.GetLayout(mLayoutKey))
+    {
+        return *cached;
+    }
+
+    std::vector<float> &layout = line.ResetLayout(mLayoutKey);
+    layout.resize(line.size() + 1);
+    layout.back() = MeasureLine(line, layout.data());
+
+    mLayoutLines.Add(aLine, aLine + 1);
+    return layout;
+}
+
+// Returns the width of the line. aOffsets, if given, receives the offset of each byte's glyph.
+float TextEditor::MeasureLine(const Line &aLine, float *aOffsets) const
+{
+    if (IsOnGrid(aLine))
+    {
+        const float columnWidth = mGlyphAdvances->Advance('#');
+        if (aOffsets == nullptr && aLine.IsPrintableAscii())
+        {
+            return static_cast<float>(aLine.size()) * columnWidth;
+        }
+
+        int column = 0;
+        for (size_t it = 0u; it < aLine.size();)
+        {
+            const size_t next = std::min(aLine.size(), it + UTF8CharLength(aLine.GetChar(it)));
+            if (aOffsets != nullptr)
+            {
+                std::fill(aOffsets + it, aOffsets + next, static_cast<float>(column) * columnWidth);
+            }
+            column = aLine.GetChar(it) == '\t' ? (column / mTabSize) * mTabSize + mTabSize : column + 1;
+            it = next;
+        }
+        return static_cast<float>(column) * columnWidth;
+    }
+
+    const float spaceSize = mGlyphAdvances->Advance(' ');
+    float distance = 0.0f;
+    for (size_t it = 0u; it < aLine.size();)
+    {
+        const size_t next = std::min(aLine.size(), it + UTF8CharLength(aLine.GetChar(it)));
+        if (aOffsets != nullptr)
+        {
+            std::fill(aOffsets + it, aOffsets + next, distance);
+        }
+
+        if (aLine.GetChar(it) == '\t')
+        {
+            distance = (1.0f + std::floor((1.0f + distance) / (static_cast<float>(mTabSize) * spaceSize))) *
+                       (static_cast<float>(mTabSize) * spaceSize);
+        } else
+        {
+            std::array<char, 6> glyph{};
+            for (size_t i = it; i < next; i++)
+            {
+                glyph.at(i - it) = static_cast<char>(aLine.GetChar(i));
+            }
+            distance += mGlyphAdvances->Advance(glyph.data(), static_cast<int>(next - it));
+        }
+        it = next;
+    }
+    return distance;
+}
+
+// Breaks a line whose glyphs start at aOffsets into rows of at most aWidth and returns their number,
+// adding the byte each row after the first starts at to aWraps if given. Rows break before the word
+// that would overflow them, or within a word that is too long for a row of its own; whitespace may
+// run past the edge, and indentation is kept on the row it starts.
+static uint32_t WrapLine(const Line &aLine, const float *aOffsets, const float aWidth, std::vector<uint32_t> *aWraps)
+{
+    uint32_t rows = 1;
+    size_t rowStart = 0;
+    size_t wordStart = 0;
+    bool rowHasText = false;
+    for (size_t i = 0; i < aLine.size();)
+    {
+        const Char c = aLine.GetChar(i);
+        const size_t next = std::min(aLine.size(), i + UTF8CharLength(c));
+        if (c == ' ' || c == '\t')
+        {
+            if (rowHasText)
+            {
+                wordStart = next;
+            }
+        } else
+        {
+            while (aOffsets[next] - aOffsets[rowStart] > aWidth && i > rowStart)
+            {
+                rowStart = wordStart > rowStart ? wordStart : i;
+                ++rows;
+                if (aWraps != nullptr)
+                {
+                    aWraps->push_back(static_cast<uint32_t>(rowStart));
+                }
+            }
+            rowHasText = true;
+        }
+        i = next;
+    }
+    return rows;
+}
+
+// The bytes the rows of aLine after the first start at when wrapped, cached along with its layout;
+// none if lines are not wrapped
+const std::vector<uint32_t> &TextEditor::GetLineWraps(const int aLine) const
+{
+    static const std::vector<uint32_t> noWraps;
+    if (!mWordWrap || mWrapWidth <= 0.0f)
+    {
+        return noWraps;
+    }
+
+    const Line &line = mLines.at(aLine);
+    if (const std::vector<uint32_t> *cached = line.GetWraps(mWrapKey))
+    {
+        return *cached;
+    }
+
+    const std::vector<float> &layout = GetLineLayout(aLine);
+    std::vector<uint32_t> &wraps = line.ResetWraps(mWrapKey);
+    WrapLine(line, layout.data(), mWrapWidth, &wraps);
+    return wraps;
+}
+
+// The number of rows aLine takes when wrapped, measuring it without caching its layout
+uint32_t TextEditor::CountLineRows(const Line &aLine)
+{
+    if (const std::vector<uint32_t> *cached = aLine.GetWraps(mWrapKey))
+    {
+        return static_cast<uint32_t>(cached->size() + 1);
+    }
+    if (MeasureLine(aLine, nullptr) <= mWrapWidth)
+    {
+        return 1;
+    }
+    mWrapOffsets.resize(aLine.size() + 1);
+    mWrapOffsets.back() = MeasureLine(aLine, mWrapOffsets.data());
+    return WrapLine(aLine, mWrapOffsets.data(), mWrapWidth, nullptr);
+}
+
+// Brings the rows of the lines up to date for wrapping at aWidth. All lines are queued when the width
+// or the layouts change, and lines as they are edited; the queued lines on screen are wrapped right
+// away, the others within kLayoutTimeBudget per frame, keeping the rows they had until then.
+void TextEditor::UpdateWrap(const float aWidth)
+{
+    if (!mWordWrap)
+    {
+        mWrapRanges.clear();
+        return;
+    }
 
-                    if (!line.at(first - bufferBegin).mPreprocessor)
-                    {
-                        if (mLanguageDefinition.mKeywords.contains(id))
-                        {
-                            token_color = PaletteIndex::Keyword;
-                        } else if (mLanguageDefinition.mIdentifiers.contains(id))
-                        {
-                            token_color = PaletteIndex::KnownIdentifier;
-                        } else if (mLanguageDefinition.mPreprocIdentifiers.contains(id))
-                        {
-                            token_color = PaletteIndex::PreprocIdentifier;
-                        }
-                    } else
-                    {
-                        if (mLanguageDefinition.mPreprocIdentifiers.contains(id))
-                        {
-                            token_color = PaletteIndex::PreprocIdentifier;
-                        }
-                    }
-                }
+    if (aWidth != mWrapWidth || mWrapLayoutKey != mLayoutKey)
+    {
+        mWrapWidth = aWidth;
+        mWrapLayoutKey = mLayoutKey;
+        ++mWrapKey;
+        ++mMeshKey;
+        mWrapRanges.clear();
+        mWrapRanges.Add(0, static_cast<int>(mLines.size()));
+    }
+    if (mWrapRanges.empty())
+    {
+        return;
+    }
 
-                for (size_t j = 0; j < token_length; ++j)
-                {
-                    line.at((token_begin - bufferBegin) + j).mColorIndex = token_color;
-                }
+    // The lines on screen, from the top line on until they fill the window
+    const int lineCount = static_cast<int>(mLines.size());
+    const int firstLine = std::min(mTopLine, lineCount - 1);
+    const int visibleRows = static_cast<int>(ceil(ImGui::GetWindowHeight() / mCharAdvance.y)) + 1;
+    int rows = -mTopRow;
+    Lines::iterator lineIt = mLines.IteratorAt(firstLine);
+    for (int i = firstLine; i < lineCount && rows < visibleRows; ++i, ++lineIt)
+    {
+        if (mWrapRanges.Contains(i))
+        {
+            mLines.SetRows(lineIt, static_cast<uint32_t>(GetLineWraps(i).size() + 1));
+            mWrapRanges.Remove(i, i + 1);
+        }
+        rows += static_cast<int>(mLines.GetRows(lineIt));
+    }
+    mTopRow = std::min(mTopRow, static_cast<int>(mLines.GetRows(mLines.IteratorAt(firstLine))) - 1);
 
-                first = token_end;
-            }
+    // Then the others, a batch at a time
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(kLayoutTimeBudget);
+    constexpr int batch = 256;
+    while (!mWrapRanges.empty() && Clock::now() < deadline)
+    {
+        const LineRanges::Range range = mWrapRanges.First();
+        const int to = std::min(range.mTo, range.mFrom + batch);
+        lineIt = mLines.IteratorAt(range.mFrom);
+        for (int i = range.mFrom; i < to; ++i, ++lineIt)
+        {
+            mLines.SetRows(lineIt, CountLineRows(*lineIt));
         }
+        mWrapRanges.Remove(range.mFrom, to);
     }
 }
 
-void TextEditor::ColorizeInternal()
+// Brings the count of line widths up to date with the lines changed since the last frame, within
+// kLayoutTimeBudget. All lines are counted anew after the font, its size or the tab size changed; until
+// they are, the longest width counted before stands in for them.
+void TextEditor::UpdateLineWidths()
 {
-    if (mLines.empty() || !mColorizerEnabled)
+    // Wrapped lines have no longest line to scroll to; the count is started anew once wrapping stops
+    if (mWordWrap)
     {
+        mWidthRanges.clear();
         return;
     }
 
-    if (mCheckComments)
+    if (mWidthKey != mLayoutKey)
     {
-        const std::size_t endLine = mLines.size();
-        constexpr int endIndex = 0;
-        std::size_t commentStartLine = endLine;
-        int commentStartIndex = endIndex;
-        bool withinString = false;
-        bool withinSingleLineComment = false;
-        bool withinPreproc = false;
-        bool firstChar = true; // there is no other non-whitespace characters in the line before
-        bool concatenate = false; // '\' on the very end of the line
-        int currentLine = 0;
-        int currentIndex = 0;
-        while (std::cmp_less(currentLine, endLine) || currentIndex < endIndex)
+        mPreviousLongestWidth = GetLongestLineWidth();
+        mLineWidths.clear();
+        mWidthRanges.clear();
+        mWidthRanges.Add(0, static_cast<int>(mLines.size()));
+        mWidthKey = mLayoutKey;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(kLayoutTimeBudget);
+    constexpr int batch = 256;
+    while (!mWidthRanges.empty() && Clock::now() < deadline)
+    {
+        const LineRanges::Range range = mWidthRanges.First();
+        const int to = std::min(range.mTo, range.mFrom + batch);
+        Lines::iterator lineIt = mLines.IteratorAt(range.mFrom);
+        for (int i = range.mFrom; i < to; ++i, ++lineIt)
         {
-            std::vector<Glyph> &line = mLines.at(currentLine);
+            UncountLineWidth(*lineIt);
+            const std::vector<float> *layout = lineIt->GetLayout(mLayoutKey);
+            const float width = layout != nullptr ? layout->back() : MeasureLine(*lineIt, nullptr);
+            lineIt->SetWidth(width, mWidthKey);
+            ++mLineWidths[width];
+        }
+        mWidthRanges.Remove(range.mFrom, to);
+    }
+    if (mWidthRanges.empty())
+    {
+        mPreviousLongestWidth = 0.0f;
+    }
+}
 
-            if (currentIndex == 0 && !concatenate)
-            {
-                withinSingleLineComment = false;
-                withinPreproc = false;
-                firstChar = true;
-            }
+// The width of the longest line counted, or of the longest counted before while not all lines are
+float TextEditor::GetLongestLineWidth() const
+{
+    return std::max(mPreviousLongestWidth, mLineWidths.empty() ? 0.0f : mLineWidths.rbegin()->first);
+}
 
-            concatenate = false;
+// Takes the line out of the count of line widths, for when it is changed or removed
+void TextEditor::UncountLineWidth(Line &aLine)
+{
+    const float width = aLine.GetWidth(mWidthKey);
+    if (width < 0.0f)
+    {
+        return;
+    }
+    const std::map<float, int>::iterator it = mLineWidths.find(width);
+    assert(it != mLineWidths.end());
+    if (--it->second == 0)
+    {
+        mLineWidths.erase(it);
+    }
+    aLine.SetWidth(-1.0f, mWidthKey);
+}
 
-            if (!line.empty())
-            {
-                const Glyph &g = line.at(currentIndex);
-                const Char c = g.mChar;
+// Whether the glyph advances fetched by the last Render() can still be used: GlyphAdvances::Clear()
+// destroys the tables, which is only noticed at the start of the next frame
+bool TextEditor::HasGlyphAdvances() const
+{
+    return mGlyphAdvances != nullptr && mGlyphGeneration == GlyphAdvances::GetGeneration();
+}
 
-                if (c != mLanguageDefinition.mPreprocChar && (isspace(c) == 0))
-                {
-                    firstChar = false;
-                }
+// Whether the line's glyphs sit on a grid of columns as wide as mCharAdvance.x
+bool TextEditor::IsOnGrid(const Line &aLine) const
+{
+    assert(mGlyphAdvances != nullptr);
+    return mMonospace || (aLine.IsPrintableAscii() && mGlyphAdvances->IsMonospace());
+}
 
-                if (currentIndex == static_cast<int>(line.size()) - 1 && line.at(line.size() - 1).mChar == '\\')
-                {
-                    concatenate = true;
-                }
+// Forgets the queued and cached lines, for when the whole document is replaced
+void TextEditor::ClearLineRanges()
+{
+    mColorizer.Replace();
+    mScanRanges.clear();
+    mColorRanges.clear();
+    mLayoutLines.clear();
+    mWidthRanges.clear();
+    mLineWidths.clear();
+    mWidthKey = 0;
+    mPreviousLongestWidth = 0.0f;
+    mWrapRanges.clear();
+    mWrapLayoutKey = 0;
+    mMinimap.mTiles.clear();
+    mMinimap.mRanges.clear();
+}
 
-                bool inComment = (std::cmp_less(commentStartLine, currentLine) ||
-                                  (std::cmp_equal(commentStartLine, currentLine) && commentStartIndex <= currentIndex));
+// Starts measuring lines anew when the font or its size changed since the last frame
+void TextEditor::UpdateLayoutKey()
+{
+    const GlyphAdvances *advances = &GlyphAdvances::Get(ImGui::GetFont(), ImGui::GetFontSize());
+    if (advances != mGlyphAdvances || GlyphAdvances::GetGeneration() != mGlyphGeneration)
+    {
+        mGlyphAdvances = advances;
+        mGlyphGeneration = GlyphAdvances::GetGeneration();
+        ++mLayoutKey;
+    }
+}
 
-                if (withinString)
-                {
-                    line.at(currentIndex).mMultiLineComment = inComment;
+// Formats and measures the line numbers of the lines [aFirstLine, aLastLine], unless they already are,
+// and sizes the gutter for the number of digits of the last line's number
+void TextEditor::UpdateGutter(const int aFirstLine, const int aLastLine)
+{
+    int digits = 1;
+    for (int n = static_cast<int>(mLines.size()); n >= 10; n /= 10)
+    {
+        ++digits;
+    }
 
-                    if (c == '\"')
-                    {
-                        if (currentIndex + 1 < static_cast<int>(line.size()) && line.at(currentIndex + 1).mChar == '\"')
-                        {
-                            currentIndex += 1;
-                            if (currentIndex < static_cast<int>(line.size()))
-                            {
-                                line.at(currentIndex).mMultiLineComment = inComment;
-                            }
-                        } else
-                        {
-                            withinString = false;
-                        }
-                    } else if (c == '\\')
-                    {
-                        currentIndex += 1;
-                        if (currentIndex < static_cast<int>(line.size()))
-                        {
-                            line.at(currentIndex).mMultiLineComment = inComment;
-                        }
-                    }
-                } else
-                {
-                    if (firstChar && c == mLanguageDefinition.mPreprocChar)
-                    {
-                        withinPreproc = true;
-                    }
+    if (mGutter.mLayoutKey != mLayoutKey || mGutter.mDigits != digits)
+    {
+        mGutter.mLayoutKey = mLayoutKey;
+        mGutter.mDigits = digits;
+        for (int i = 0; i < 10; ++i)
+        {
+            mGutter.mDigitWidths.at(i) = mGlyphAdvances->Advance(static_cast<char>('0' + i));
+        }
+        mGutter.mSpaceWidth = mGlyphAdvances->Advance(' ');
+        mGutter.mNumbers.clear();
 
-                    if (c == '\"')
-                    {
-                        withinString = true;
-                        line.at(currentIndex).mMultiLineComment = inComment;
-                    } else
-                    {
-                        auto pred = [](const char &a, const Glyph &b) {
-                            return a == b.mChar;
-                        };
-                        auto from = line.begin() + currentIndex;
-                        std::string &startStr = mLanguageDefinition.mCommentStart;
-                        std::string &singleStartStr = mLanguageDefinition.mSingleLineComment;
-
-                        if (!singleStartStr.empty() &&
-                            currentIndex + singleStartStr.size() <= line.size() &&
-                            equals(singleStartStr.begin(),
-                                   singleStartStr.end(),
-                                   from,
-                                   from + singleStartStr.size(),
-                                   pred))
-                        {
-                            withinSingleLineComment = true;
-                        } else if (!withinSingleLineComment &&
-                                   currentIndex + startStr.size() <= line.size() &&
-                                   equals(startStr.begin(), startStr.end(), from, from + startStr.size(), pred))
-                        {
-                            commentStartLine = currentLine;
-                            commentStartIndex = currentIndex;
-                        }
+        // A space either side of the widest number of that many digits
+        const float widestDigit = *std::max_element(mGutter.mDigitWidths.begin(), mGutter.mDigitWidths.end());
+        mTextStart = mGutter.mSpaceWidth * 2.0f + widestDigit * static_cast<float>(digits) +
+                     static_cast<float>(mLeftMargin);
+    }
+
+    const int count = std::max(0, aLastLine - aFirstLine + 1);
+    if (mGutter.mFirstLine == aFirstLine && mGutter.mNumbers.size() == static_cast<size_t>(count))
+    {
+        return;
+    }
+
+    mGutter.mFirstLine = aFirstLine;
+    mGutter.mText.clear();
+    mGutter.mNumbers.clear();
+    std::array<char, 16> buf{};
+    for (int line = aFirstLine; line <= aLastLine; ++line)
+    {
+        char *end = std::to_chars(buf.data(), buf.data() + buf.size(), line + 1).ptr;
+        // Two spaces follow the number
+        float width = mGutter.mSpaceWidth * 2.0f;
+        for (const char *digit = buf.data(); digit != end; ++digit)
+        {
+            width += mGutter.mDigitWidths.at(*digit - '0');
+        }
+        mGutter.mText.append(buf.data(), end);
+        mGutter.mNumbers.emplace_back(static_cast<uint32_t>(mGutter.mText.size()), width);
+    }
+}
+
+// Width the minimap takes from the right of the window, 0 if it is not shown
+float TextEditor::GetMinimapWidth() const
+{
+    return mShowMinimap ? static_cast<float>(kMinimapColumns) * kMinimapColumnWidth + 2.0f * kMinimapPadding : 0.0f;
+}
+
+// Draws the minimap along the right edge of the window, the lines [aFirstLine, aLastLine] being in view.
+// Once the document has more lines than fit, the lines shown follow the scroll position proportionally,
+// so only a window's height of tiles is drawn however long it is. Tiles are built when first drawn, and
+// again once their lines are edited or recolored.
+void TextEditor::DrawMinimap(ImDrawList *aDrawList, const int aFirstLine, const int aLastLine)
+{
+    const int lineCount = static_cast<int>(mLines.size());
+    if (mMinimap.mLayoutKey != mLayoutKey)
+    {
+        // Tabs span the tab size, and blocks are drawn with the white pixel of the font's atlas
+        mMinimap.mLayoutKey = mLayoutKey;
+        mMinimap.mRanges.Add(0, lineCount);
+    }
+    // Tiles for the lines not covered yet, when first drawn or after the document was replaced
+    const int covered = mMinimap.mTiles.empty() ? 0 : mMinimap.mTiles.back().mTo;
+    for (int from = covered; from < lineCount; from += kMinimapTileLines)
+    {
+        mMinimap.mTiles.push_back({from, std::min(lineCount, from + kMinimapTileLines), {}});
+    }
+    mMinimap.mRanges.Add(covered, lineCount);
+    assert(mMinimap.mTiles.back().mTo == lineCount);
+
+    mMinimap.mMax = aDrawList->GetClipRectMax();
+    mMinimap.mMin = ImVec2(mMinimap.mMax.x - GetMinimapWidth(), aDrawList->GetClipRectMin().y);
+    const int panelLines = std::max(1, static_cast<int>((mMinimap.mMax.y - mMinimap.mMin.y) / kMinimapRowHeight));
+
+    const double range = GetScrollRange();
+    const double fraction = range > 0.0 ? GetScrollTop() / range : 0.0;
+    mMinimap.mFirstLine = static_cast<int>(std::round(fraction * std::max(0, lineCount - panelLines)));
+
+    // The view frame moves through the panel while the document scrolls through its range
+    const int viewLines = aLastLine - aFirstLine + 1;
+    const float travel = static_cast<float>(std::min(panelLines, lineCount) - viewLines) * kMinimapRowHeight;
+    mMinimap.mScrollRatio = travel > 0.0f ? range / travel : 0.0;
+    mMinimap.mViewTop = mMinimap.mMin.y + static_cast<float>(aFirstLine - mMinimap.mFirstLine) * kMinimapRowHeight;
+    mMinimap.mViewBottom = mMinimap.mViewTop + static_cast<float>(viewLines) * kMinimapRowHeight;
+
+    aDrawList->PushClipRect(mMinimap.mMin, mMinimap.mMax, true);
+    aDrawList->AddRectFilled(mMinimap.mMin, mMinimap.mMax, mPalette.at(static_cast<int>(PaletteIndex::Background)));
+
+    const int tileCount = static_cast<int>(mMinimap.mTiles.size());
+    const int firstTile = static_cast<int>(std::ranges::upper_bound(mMinimap.mTiles, mMinimap.mFirstLine, {}, &MinimapTile::mTo) -
+                                           mMinimap.mTiles.begin());
+    int lastTile = firstTile - 1;
+    for (int tile = firstTile; tile < tileCount && mMinimap.mTiles.at(tile).mFrom <= mMinimap.mFirstLine + panelLines; ++tile)
+    {
+        const MinimapTile &minimapTile = mMinimap.mTiles.at(tile);
+        if (!mMinimap.mRanges.First(minimapTile.mFrom, minimapTile.mTo).empty())
+        {
+            BuildMinimapTile(tile);
+        }
+        const ImVec2 tilePos(mMinimap.mMin.x + kMinimapPadding,
+                             mMinimap.mMin.y + static_cast<float>(minimapTile.mFrom - mMinimap.mFirstLine) * kMinimapRowHeight);
+        DrawLineMesh(aDrawList, minimapTile.mMesh, tilePos);
+        lastTile = tile;
+    }
 
-                        inComment = inComment = (std::cmp_less(commentStartLine, currentLine) ||
-                                                 (std::cmp_equal(commentStartLine, currentLine) &&
-                                                  commentStartIndex <= currentIndex));
+    const ImVec2 viewMin(mMinimap.mMin.x, mMinimap.mViewTop);
+    const ImVec2 viewMax(mMinimap.mMax.x, mMinimap.mViewBottom);
+    aDrawList->AddRectFilled(viewMin, viewMax, mPalette.at(static_cast<int>(PaletteIndex::CurrentLineFillInactive)));
+    aDrawList->AddRect(viewMin, viewMax, mPalette.at(static_cast<int>(PaletteIndex::CurrentLineEdge)));
+    aDrawList->PopClipRect();
 
-                        line.at(currentIndex).mMultiLineComment = inComment;
-                        line.at(currentIndex).mComment = withinSingleLineComment;
+    // Keep the tiles of a panel's height either side, for scrolling back and forth
+    const int shownTiles = lastTile - firstTile + 1;
+    TrimMinimapTiles(firstTile - shownTiles, lastTile + 1 + shownTiles);
+}
 
-                        std::string &endStr = mLanguageDefinition.mCommentEnd;
-                        if (currentIndex + 1 >= static_cast<int>(endStr.size()) &&
-                            equals(endStr.begin(), endStr.end(), from + 1 - endStr.size(), from + 1, pred))
-                        {
-                            commentStartIndex = endIndex;
-                            commentStartLine = endLine;
-                        }
-                    }
+// Adds a block over the columns [aFrom, aTo) of the minimap row at aY to aTile
+static void AddMinimapBlock(Line::Mesh &aTile,
+                            const int aFrom,
+                            const int aTo,
+                            const float aY,
+                            const ImU32 aColor,
+                            const ImVec2 &aUv)
+{
+    const size_t first = aTile.mVertices.size();
+    const float left = static_cast<float>(aFrom) * kMinimapColumnWidth;
+    const float right = static_cast<float>(aTo) * kMinimapColumnWidth;
+    const float bottom = aY + kMinimapRowHeight;
+    aTile.mVertices.push_back({ImVec2(left, aY), aUv, aColor});
+    aTile.mVertices.push_back({ImVec2(right, aY), aUv, aColor});
+    aTile.mVertices.push_back({ImVec2(right, bottom), aUv, aColor});
+    aTile.mVertices.push_back({ImVec2(left, bottom), aUv, aColor});
+    for (const size_t index: {0, 1, 2, 0, 2, 3})
+    {
+        aTile.mIndices.push_back(static_cast<ImDrawIdx>(first + index));
+    }
+}
+
+// Builds tile aTile from the colors of its lines: a block for each run of equally colored glyphs between
+// whitespace, a column per glyph and tabs up to the next tab stop
+void TextEditor::BuildMinimapTile(const int aTile)
+{
+    const int from = mMinimap.mTiles.at(aTile).mFrom;
+    const int to = mMinimap.mTiles.at(aTile).mTo;
+    const int tabSize = std::max(1, mTabSize);
+    const ImVec2 uv = ImGui::GetDrawListSharedData()->TexUvWhitePixel;
+
+    Line::Mesh &tile = mMinimap.mTiles.at(aTile).mMesh;
+    tile.mVertices.clear();
+    tile.mIndices.clear();
+
+    Lines::iterator lineIt = mLines.IteratorAt(from);
+    for (int i = from; i < to; ++i, ++lineIt)
+    {
+        Line &line = *lineIt;
+        if (!line.HasStyleRuns())
+        {
+            line.UpdateStyleRuns();
+        }
+
+        const float y = static_cast<float>(i - from) * kMinimapRowHeight;
+        int column = 0;
+        int blockStart = -1; // -1 between blocks
+        ImU32 blockColor = 0;
+        for (const Line::StyleRun &run: line.GetStyleRuns())
+        {
+            if (column >= kMinimapColumns)
+            {
+                break;
+            }
+            const ImU32 color = mStyleColors.at(run.mStyle);
+            for (size_t j = run.mStart; j < run.mStart + run.mLength && column < kMinimapColumns; ++j)
+            {
+                const Char c = line.GetChar(j);
+                if (IsUTFSequence(c))
+                {
+                    continue;
                 }
-                line.at(currentIndex).mPreprocessor = withinPreproc;
-                currentIndex += UTF8CharLength(c);
-                if (currentIndex >= static_cast<int>(line.size()))
+                const bool space = c == ' ' || c == '\t';
+                if (blockStart >= 0 && (space || color != blockColor))
                 {
-                    currentIndex = 0;
-                    ++currentLine;
+                    AddMinimapBlock(tile, blockStart, column, y, blockColor, uv);
+                    blockStart = -1;
                 }
-            } else
-            {
-                currentIndex = 0;
-                ++currentLine;
+                if (c == '\t')
+                {
+                    column = (column / tabSize + 1) * tabSize;
+                    continue;
+                }
+                if (!space && blockStart < 0)
+                {
+                    blockStart = column;
+                    blockColor = color;
+                }
+                ++column;
             }
         }
-        mCheckComments = false;
+        if (blockStart >= 0)
+        {
+            AddMinimapBlock(tile, blockStart, column, y, blockColor, uv);
+        }
+    }
+
+    mMinimap.mRanges.Remove(from, to);
+}
+
+// Follows aCount lines inserted before line aIndex: the tile they are inserted into grows, and is split
+// once it holds too many lines, while the tiles below move down unchanged
+void TextEditor::InsertMinimapLines(const int aIndex, const int aCount)
+{
+    mMinimap.mRanges.InsertLines(aIndex, aCount);
+    mMinimap.mRanges.Add(aIndex, aIndex + aCount);
+
+    std::vector<MinimapTile> &tiles = mMinimap.mTiles;
+    if (tiles.empty())
+    {
+        return;
     }
 
-    if (mColorRangeMin < mColorRangeMax)
+    // The tile holding line aIndex, or the last one for lines added at the end
+    std::vector<MinimapTile>::iterator tile = std::ranges::upper_bound(tiles, aIndex, {}, &MinimapTile::mFrom) - 1;
+    tile->mTo += aCount;
+    for (std::vector<MinimapTile>::iterator next = tile + 1; next != tiles.end(); ++next)
     {
-        const int increment = (mLanguageDefinition.mTokenize == nullptr) ? 10 : 10000;
-        const int to = std::min(mColorRangeMin + increment, mColorRangeMax);
-        ColorizeRange(mColorRangeMin, to);
-        mColorRangeMin = to;
+        next->mFrom += aCount;
+        next->mTo += aCount;
+    }
 
-        if (mColorRangeMax == mColorRangeMin)
+    const int from = tile->mFrom;
+    const int lines = tile->mTo - from;
+    if (lines > kMinimapTileLines)
+    {
+        // Split it evenly, so that the parts have room to grow again
+        const int parts = (lines + kMinimapTileLines - 1) / kMinimapTileLines;
+        std::vector<MinimapTile> split(parts);
+        for (int i = 0; i < parts; ++i)
         {
-            mColorRangeMin = std::numeric_limits<int>::max();
-            mColorRangeMax = 0;
+            split.at(i).mFrom = from + static_cast<int>(static_cast<int64_t>(lines) * i / parts);
+            split.at(i).mTo = from + static_cast<int>(static_cast<int64_t>(lines) * (i + 1) / parts);
         }
+        tiles.insert(tiles.erase(tile), split.begin(), split.end());
+        mMinimap.mRanges.Add(from, from + lines);
+    }
+}
+
+// Follows the lines [aFirst, aLast) being removed: the tiles holding them shrink, those left without any
+// lines are dropped, and the tiles below move up unchanged
+void TextEditor::EraseMinimapLines(const int aFirst, const int aLast)
+{
+    mMinimap.mRanges.EraseLines(aFirst, aLast);
+
+    std::vector<MinimapTile> &tiles = mMinimap.mTiles;
+    if (tiles.empty())
+    {
         return;
     }
+
+    const int count = aLast - aFirst;
+    const auto shift = [aFirst, aLast, count](const int aLine) {
+        return aLine < aFirst ? aLine : aLine < aLast ? aFirst : aLine - count;
+    };
+    for (std::vector<MinimapTile>::iterator tile = std::ranges::upper_bound(tiles, aFirst, {}, &MinimapTile::mTo);
+         tile != tiles.end();
+         ++tile)
+    {
+        tile->mFrom = shift(tile->mFrom);
+        tile->mTo = shift(tile->mTo);
+    }
+    std::erase_if(tiles, [](const MinimapTile &aTile) {
+        return aTile.mFrom == aTile.mTo;
+    });
+
+    // The tiles that lost lines, either side of where they were
+    mMinimap.mRanges.Add(std::max(0, aFirst - 1), std::min(static_cast<int>(mLines.size()), aFirst + 1));
 }
 
-float TextEditor::TextDistanceToLineStart(const Coordinates &aFrom) const
+// Frees the minimap tiles outside [aFromTile, aToTile), queueing their lines to be built again
+void TextEditor::TrimMinimapTiles(const int aFromTile, const int aToTile)
 {
-    const std::vector<Glyph> &line = mLines.at(aFrom.mLine);
-    float distance = 0.0f;
-    const float
-            spaceSize = ImGui::GetFont()->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX, -1.0f, " ", nullptr, nullptr).x;
-    const int colIndex = GetCharacterIndex(aFrom);
-    for (size_t it = 0u; it < line.size() && it < colIndex;)
+    const int tileCount = static_cast<int>(mMinimap.mTiles.size());
+    const std::array<LineRanges::Range, 2> outside{{{0, std::min(tileCount, aFromTile)}, {std::max(0, aToTile), tileCount}}};
+    for (const LineRanges::Range &tiles: outside)
     {
-        if (line.at(it).mChar == '\t')
-        {
-            distance = (1.0f + std::floor((1.0f + distance) / (static_cast<float>(mTabSize) * spaceSize))) *
-                       (static_cast<float>(mTabSize) * spaceSize);
-            ++it;
-        } else
+        for (int i = tiles.mFrom; i < tiles.mTo; ++i)
         {
-            int d = UTF8CharLength(line.at(it).mChar);
-            std::array<char, 7> tempCString{};
-            int i = 0;
-            for (; i < 6 && d-- > 0 && it < static_cast<int>(line.size()); i++, it++)
+            // Tiles whose lines are all queued are not built
+            MinimapTile &tile = mMinimap.mTiles.at(i);
+            if (!mMinimap.mRanges.Contains(tile.mFrom, tile.mTo))
             {
-                tempCString.at(i) = line.at(it).mChar;
+                tile.mMesh = Line::Mesh();
+                mMinimap.mRanges.Add(tile.mFrom, tile.mTo);
             }
+        }
+    }
+}
+
+// Scrolls by the minimap: a click scrolls the line clicked into the middle of the window unless it is in
+// view already, and dragging on from there scrolls along. Returns true while the minimap has the mouse,
+// which the text then leaves alone.
+bool TextEditor::HandleMinimapInputs()
+{
+    if (!mShowMinimap)
+    {
+        return false;
+    }
 
-            tempCString.at(i) = '\0';
-            distance += ImGui::GetFont()
-                                ->CalcTextSizeA(ImGui::GetFontSize(),
-                                                FLT_MAX,
-                                                -1.0f,
-                                                tempCString.data(),
-                                                nullptr,
-                                                nullptr)
-                                .x;
+    const float mouseY = ImGui::GetMousePos().y;
+    if (mMinimap.mDragging)
+    {
+        mMinimap.mDragging = ImGui::IsMouseDown(0);
+        if (mMinimap.mDragging)
+        {
+            ScrollToY(mMinimap.mDragTop + static_cast<double>(mouseY - mMinimap.mDragY) * mMinimap.mScrollRatio);
         }
+        return true;
     }
 
-    return distance;
+    if (!ImGui::IsWindowHovered() || !ImGui::IsMouseHoveringRect(mMinimap.mMin, mMinimap.mMax))
+    {
+        return false;
+    }
+
+    if (ImGui::IsMouseClicked(0))
+    {
+        if (mouseY < mMinimap.mViewTop || mouseY >= mMinimap.mViewBottom)
+        {
+            const int line = std::clamp(mMinimap.mFirstLine +
+                                                static_cast<int>(std::floor((mouseY - mMinimap.mMin.y) / kMinimapRowHeight)),
+                                        0,
+                                        static_cast<int>(mLines.size()) - 1);
+            ScrollToY(static_cast<double>(GetLineRow(line)) * mCharAdvance.y + (mCharAdvance.y - mViewHeight) / 2.0);
+        }
+        mMinimap.mDragging = true;
+        mMinimap.mDragY = mouseY;
+        mMinimap.mDragTop = GetScrollTop();
+    }
+    return true;
+}
+
+// Frees the cached layouts of the lines outside [aFromLine, aToLine)
+void TextEditor::TrimLineLayouts(const int aFromLine, const int aToLine)
+{
+    std::vector<LineRanges::Range> trimmed;
+    for (const LineRanges::Range &range: mLayoutLines)
+    {
+        if (range.mFrom < aFromLine)
+        {
+            trimmed.push_back({range.mFrom, std::min(range.mTo, aFromLine)});
+        }
+        if (range.mTo > aToLine)
+        {
+            trimmed.push_back({std::max(range.mFrom, aToLine), range.mTo});
+        }
+    }
+
+    for (const LineRanges::Range &range: trimmed)
+    {
+        Lines::iterator lineIt = mLines.IteratorAt(range.mFrom);
+        for (int i = range.mFrom; i < range.mTo; ++i, ++lineIt)
+        {
+            lineIt->ClearLayout();
+        }
+        mLayoutLines.Remove(range.mFrom, range.mTo);
+    }
+}
+
+// Height of the whole document in pixels
+double TextEditor::GetDocumentHeight() const
+{
+    return static_cast<double>(mWordWrap ? mLines.rows() : mLines.size()) * mCharAdvance.y;
+}
+
+// How far the document can be scrolled, in pixels
+double TextEditor::GetScrollRange() const
+{
+    return std::max(0.0, GetDocumentHeight() - mViewHeight);
+}
+
+// Distance of the top of the window from the top of the document, in pixels
+double TextEditor::GetScrollTop() const
+{
+    return static_cast<double>(GetLineRow(mTopLine) + mTopRow) * mCharAdvance.y + mTopOffset;
+}
+
+// The screen row aLine starts at
+int TextEditor::GetLineRow(const int aLine) const
+{
+    if (!mWordWrap)
+    {
+        return aLine;
+    }
+    return static_cast<int>(mLines.RowOf(std::min(static_cast<size_t>(aLine), mLines.size())));
+}
+
+// Screen y of the top of aLine
+float TextEditor::GetLineScreenY(const int aLine) const
+{
+    // Where the top of the document would be if it was not scrolled
+    const float top = ImGui::GetCursorScreenPos().y + ImGui::GetScrollY();
+    const int rows = GetLineRow(aLine) - GetLineRow(mTopLine) - mTopRow;
+    return top + static_cast<float>(static_cast<double>(rows) * mCharAdvance.y - mTopOffset);
+}
+
+// The line at screen y aY, which may lie outside of the document, and in aRow the row of it. Rows past
+// the end of a wrapped document belong to its last line.
+int TextEditor::GetScreenYLine(const float aY, int *aRow) const
+{
+    const float top = ImGui::GetCursorScreenPos().y + ImGui::GetScrollY();
+    const int row = GetLineRow(mTopLine) + mTopRow + static_cast<int>(std::floor((aY - top + mTopOffset) / mCharAdvance.y));
+    size_t subRow = 0;
+    const int line = mWordWrap && row >= 0 ? static_cast<int>(mLines.LineAtRow(static_cast<size_t>(row), subRow)) : row;
+    if (aRow != nullptr)
+    {
+        *aRow = static_cast<int>(subRow);
+    }
+    return line;
+}
+
+// Scrolls the top of the window to aY pixels from the top of the document. ImGui's scroll position
+// follows at the end of the frame.
+void TextEditor::ScrollToY(double aY)
+{
+    aY = std::clamp(aY, 0.0, GetScrollRange());
+    const int row = static_cast<int>(std::floor(aY / mCharAdvance.y));
+    mTopOffset = static_cast<float>(aY - static_cast<double>(row) * mCharAdvance.y);
+
+    size_t subRow = 0;
+    mTopLine = mWordWrap ? static_cast<int>(mLines.LineAtRow(static_cast<size_t>(row), subRow)) : row;
+    mTopRow = static_cast<int>(subRow);
+}
+
+// Brings the top line up to date with the window's scroll position at the start of a frame. The
+// position is kept as a line, a row of it and an offset into that, so that it stays where it is as
+// lines above it are wrapped again, and exact however long the document is: past kMaxScrollHeight
+// ImGui only scrolls through a proxy of that height, whose scrollbar maps to the document
+// proportionally.
+void TextEditor::UpdateScroll()
+{
+    if (mCharAdvance.y <= 0.0f)
+    {
+        return;
+    }
+
+    mVirtualScroll = GetDocumentHeight() > kMaxScrollHeight;
+    // Nothing has been drawn yet, so this is the height ImGui scrolls the document through
+    mViewHeight = ImGui::GetContentRegionAvail().y;
+
+    const float scrollY = ImGui::GetScrollY();
+    double top = GetScrollTop();
+    if (mVirtualScroll && ImGui::GetIO().MouseWheel != 0.0f && ImGui::IsWindowHovered())
+    {
+        // Wheel through the document itself, the proxy would stall near its ends
+        top -= ImGui::GetIO().MouseWheel * 3.0f * mCharAdvance.y;
+    } else if (std::abs(scrollY - mScrollY) >= 1.0f)
+    {
+        // Scrolled with the wheel or the scrollbar, or by the host
+        if (!mVirtualScroll)
+        {
+            top = scrollY;
+        } else
+        {
+            // Land on the line at that proportion of the document
+            const float scrollMax = ImGui::GetScrollMaxY();
+            const double fraction = scrollMax > 0.0f ? scrollY / scrollMax : 0.0;
+            top = std::round(fraction * GetScrollRange() / mCharAdvance.y) * mCharAdvance.y;
+        }
+    }
+
+    // Also clamps the position after lines were removed
+    ScrollToY(top);
 }
 
 void TextEditor::EnsureCursorVisible()
@@ -2698,28 +4543,38 @@ void TextEditor::EnsureCursorVisible()
     }
 
     const float scrollX = ImGui::GetScrollX();
-    const float scrollY = ImGui::GetScrollY();
 
     const float height = ImGui::GetWindowHeight();
-    const float width = ImGui::GetWindowWidth();
+    // Not under the minimap
+    const float width = ImGui::GetWindowWidth() - GetMinimapWidth();
 
-    const int top = 1 + static_cast<int>(ceil(scrollY / mCharAdvance.y));
-    const int bottom = static_cast<int>(ceil((scrollY + height) / mCharAdvance.y));
+    // In screen rows
+    const int topRow = GetLineRow(mTopLine) + mTopRow;
+    const int top = 1 + topRow + (mTopOffset > 0.0f ? 1 : 0);
+    const int bottom = topRow + static_cast<int>(ceil((mTopOffset + height) / mCharAdvance.y));
 
     const int left = static_cast<int>(ceil(scrollX / mCharAdvance.x));
     const int right = static_cast<int>(ceil((scrollX + width) / mCharAdvance.x));
 
     const Coordinates pos = GetActualCursorCoordinates();
-    const float len = TextDistanceToLineStart(pos);
+    const int row = GetLineRow(pos.mLine) + static_cast<int>(FindRow(GetLineWraps(pos.mLine), GetCharacterIndex(pos)));
 
-    if (pos.mLine < top)
+    if (row < top)
     {
-        ImGui::SetScrollY(std::max(0.0f, static_cast<float>(pos.mLine - 1) * mCharAdvance.y));
+        ScrollToY(std::max(0.0, static_cast<double>(row - 1) * mCharAdvance.y));
     }
-    if (pos.mLine > bottom - 4)
+    if (row > bottom - 4)
     {
-        ImGui::SetScrollY(std::max(0.0f, static_cast<float>(pos.mLine + 4) * mCharAdvance.y - height));
+        ScrollToY(std::max(0.0, static_cast<double>(row + 4) * mCharAdvance.y - height));
     }
+
+    // Wrapped lines do not scroll horizontally
+    if (mWordWrap)
+    {
+        return;
+    }
+
+    const float len = TextDistanceToLineStart(pos);
     if (len + mTextStart < static_cast<float>(left) + 4)
     {
         ImGui::SetScrollX(std::max(0.0f, len + mTextStart - 4));
@@ -2781,14 +4636,14 @@ void TextEditor::UndoRecord::Redo(TextEditor *aEditor) const
     if (!mRemoved.empty())
     {
         aEditor->DeleteRange(mRemovedStart, mRemovedEnd);
-        aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 1);
+        aEditor->Colorize(mRemovedStart.mLine - 1, mRemovedEnd.mLine - mRemovedStart.mLine + 2);
     }
 
     if (!mAdded.empty())
     {
         Coordinates start = mAddedStart;
         (void)aEditor->InsertTextAt(start, mAdded.c_str());
-        aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 1);
+        aEditor->Colorize(mAddedStart.mLine - 1, mAddedEnd.mLine - mAddedStart.mLine + 2);
     }
 
     aEditor->mState = mAfter;
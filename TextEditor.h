@@ -2,21 +2,33 @@
 
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <utility>
 #include <vector>
+#include "ColorizerThread.h"
+#include "GlyphAdvances.h"
 #include "imgui.h"
 #include "LanguageDefinition.h"
+#include "LineRanges.h"
+#include "Lines.h"
 #include "Palette.h"
+#include "RegexDFA.h"
 #include "Types.h"
 
 class TextEditor
 {
     public:
         TextEditor();
-        ~TextEditor() = default;
+        ~TextEditor();
+        // Copies do not share the colorizer thread: a copy colorizing in the background starts one of
+        // its own when it is first needed, and assigning stops the thread of the editor assigned to.
+        TextEditor(const TextEditor &) = default;
+        TextEditor &operator=(const TextEditor &) = default;
 
         void SetLanguageDefinition(const LanguageDefinition &aLanguageDef);
         const LanguageDefinition &GetLanguageDefinition() const
@@ -33,13 +45,24 @@ class TextEditor
         void SetErrorMarkers(const ErrorMarkers &aMarkers)
         {
             mErrorMarkers = aMarkers;
+            ++mMarkersVersion;
         }
         void SetBreakpoints(const Breakpoints &aMarkers)
         {
             mBreakpoints = aMarkers;
+            ++mMarkersVersion;
         }
 
         void Render(const char *aTitle, const ImVec2 &aSize = ImVec2(), bool aBorder = false);
+
+        // True if rendering again would show something the last frame did not: the text, selection,
+        // scroll position, size, focus or hover state changed during or since it, or colorizing has work
+        // left. Hosts that render on input only may skip frames while it is false, waking up for the
+        // cursor blink after GetTimeToNextBlink().
+        bool IsRenderNeeded() const;
+        // Milliseconds until the blinking cursor is due to be shown or hidden, 0 if it already is, or -1
+        // if the editor was not focused in the last frame and so shows no cursor.
+        int GetTimeToNextBlink() const;
         void SetText(const std::string &aText);
         std::string GetText() const;
 
@@ -78,6 +101,36 @@ class TextEditor
         }
         void SetColorizerEnable(bool aValue);
 
+        // Runs tokenizing and comment scanning on a worker thread. Results are applied at the start
+        // of the next Render() if the lines they were computed from have not been edited since.
+        bool IsColorizingInBackground() const
+        {
+            return mColorizeInBackground;
+        }
+        void SetColorizeInBackground(bool aValue);
+
+        // Number of threads the whole document is colorized with when it is queued at once, e.g. after
+        // SetText() or SetLanguageDefinition(). More than 1 colorizes it within the next Render(), which
+        // blocks until all of it is done, ignoring the time budget. The default, 1, colorizes it in chunks
+        // over several frames instead, visible lines first, as does colorizing in the background.
+        int GetColorizeThreadCount() const
+        {
+            return mColorizeThreadCount;
+        }
+        void SetColorizeThreadCount(int aValue);
+
+        // Time in microseconds Render() spends colorizing each frame, visible lines first. 0 or less
+        // colorizes a fixed number of lines per frame instead. Colorizing the whole document on
+        // several threads, or in the background, does not keep to it.
+        int GetColorizeTimeBudget() const
+        {
+            return mColorizeTimeBudget;
+        }
+        void SetColorizeTimeBudget(int aMicroseconds)
+        {
+            mColorizeTimeBudget = aMicroseconds;
+        }
+
         Coordinates GetCursorPosition() const
         {
             return GetActualCursorCoordinates();
@@ -114,12 +167,52 @@ class TextEditor
         void SetShowWhitespaces(const bool aValue)
         {
             mShowWhitespaces = aValue;
+            ++mMeshKey;
         }
         bool IsShowingWhitespaces() const
         {
             return mShowWhitespaces;
         }
 
+        // Lays glyphs out on a grid of equally wide columns, computing positions from the column instead of
+        // measuring the line. Lines of printable ASCII are on the grid whenever the font's ASCII characters
+        // are equally wide; declaring the font monospaced puts lines with tabs and UTF-8 on it as well.
+        void SetMonospace(bool aValue);
+        bool IsMonospace() const
+        {
+            return mMonospace;
+        }
+
+        // Keeps the vertices each visible line's text was drawn with, and draws unchanged lines by copying
+        // them into the draw list instead of laying their text out again. Lines are drawn anew when edited
+        // or recolored, and all of them when the font, palette or horizontal scroll position changes.
+        void SetRetainedRendering(const bool aValue)
+        {
+            mRetainedRendering = aValue;
+        }
+        bool IsRetainedRendering() const
+        {
+            return mRetainedRendering;
+        }
+
+        // Wraps lines at word boundaries to the width of the window instead of scrolling horizontally.
+        // Lines are wrapped again as they are edited or the width changes: those on screen right away,
+        // the rest within a time budget per frame.
+        void SetWordWrap(bool aValue);
+        bool IsWordWrap() const
+        {
+            return mWordWrap;
+        }
+
+        // Shows a minimap of the document along the right edge of the window: each line a row of blocks in
+        // the colors of its text, and the lines in view framed. Clicking it scrolls the line clicked into the
+        // middle of the window, and dragging scrolls along.
+        void SetShowMinimap(bool aValue);
+        bool IsShowingMinimap() const
+        {
+            return mShowMinimap;
+        }
+
         void SetTabSize(int aValue);
 
         int GetTabSize() const
@@ -161,11 +254,124 @@ class TextEditor
     private:
         using RegexList = std::vector<std::pair<std::regex, PaletteIndex>>;
 
+        // The line numbers of the visible lines, formatted and measured with the widths of the digits
+        struct Gutter
+        {
+                uint32_t mLayoutKey = 0; // layout key the digits were measured with, 0 for none
+                int mDigits = 0; // the number of digits of the line count the gutter is sized for
+                std::array<float, 10> mDigitWidths{};
+                float mSpaceWidth = 0.0f;
+                int mFirstLine = 0; // line of the first number
+                std::string mText; // the numbers, one after another
+                // Offset of the end of each number in mText and its width, including the two spaces after it
+                std::vector<std::pair<uint32_t, float>> mNumbers;
+        };
+
+        // Whitespace marker vertices relative to their anchor, for one font size: the space dot's around
+        // the middle of the space, the tab arrow head's two quads around the tip of the arrow
+        struct WhitespaceMarkers
+        {
+                float mFontSize = 0.0f;
+                bool mVisible = false; // false if the markers would be smaller than a pixel
+                std::array<ImVec2, 4> mDot{};
+                std::array<ImVec2, 8> mArrowHead{};
+        };
+
+        // A tile of the minimap: the blocks of a run of up to kMinimapTileLines lines in the vertex layout
+        // of line meshes, relative to the top left of the tile. Tiles move along with their lines as lines
+        // are inserted or removed above them.
+        struct MinimapTile
+        {
+                int mFrom = 0; // the lines [mFrom, mTo) the tile holds
+                int mTo = 0;
+                Line::Mesh mMesh;
+        };
+
+        // The minimap's tiles, covering all lines in order, and where the last frame drew it
+        struct Minimap
+        {
+                uint32_t mLayoutKey = 0; // layout key the tiles were built with, 0 for none
+                std::vector<MinimapTile> mTiles;
+                LineRanges mRanges; // lines whose tile has to be built anew
+                ImVec2 mMin; // the panel, empty if not drawn
+                ImVec2 mMax;
+                int mFirstLine = 0; // line at the top of the panel
+                float mViewTop = 0.0f; // the lines in view, in screen y
+                float mViewBottom = 0.0f;
+                double mScrollRatio = 0.0; // pixels of the document per pixel the view frame moves
+                bool mDragging = false;
+                float mDragY = 0.0f; // mouse y and scroll position the drag started at
+                double mDragTop = 0.0;
+        };
+
+        // Owns the colorizer thread, which runs jobs for this editor only. Copying the editor leaves
+        // the copy without one; assigning to it stops the thread, and as it is the first member, it
+        // does so before any of the state the thread reads is overwritten.
+        struct Colorizer
+        {
+                Colorizer() = default;
+                Colorizer(const Colorizer &)
+                {}
+                Colorizer &operator=(const Colorizer &)
+                {
+                    mThread.reset();
+                    mShifts.clear();
+                    mEdited.clear();
+                    mReplaced = false;
+                    return *this;
+                }
+
+                // Follow the edits made while a job is out on the thread, to find its lines again
+                void InsertLines(int aIndex, int aCount);
+                void EraseLines(int aFirst, int aLast);
+                void Invalidate(int aFrom, int aTo);
+                void Replace();
+                // The index the job's line aIndex has now, or -1 if it was erased, edited or queued again
+                int FindLine(int aIndex) const;
+
+                // Lines inserted (mCount > 0) at, or erased (mCount < 0) from mIndex, in the order made
+                struct Shift
+                {
+                        int mIndex = 0;
+                        int mCount = 0;
+                };
+
+                std::unique_ptr<ColorizerThread> mThread;
+                // Since the job out on the thread was submitted
+                std::vector<Shift> mShifts;
+                LineRanges mEdited;
+                bool mReplaced = false; // the whole document was
+        };
+
         struct EditorState
         {
                 Coordinates mSelectionStart;
                 Coordinates mSelectionEnd;
                 Coordinates mCursorPosition;
+
+                bool operator==(const EditorState &) const = default;
+        };
+
+        // What a frame showed, to tell whether the next one would differ
+        struct FrameState
+        {
+                uint64_t mDocumentVersion = 0;
+                EditorState mState;
+                uint32_t mMarkersVersion = 0;
+                uint32_t mLayoutKey = 0;
+                uint32_t mMeshKey = 0;
+                bool mShowMinimap = false;
+                float mScrollX = 0.0f;
+                float mScrollY = 0.0f;
+                float mWidth = 0.0f;
+                float mHeight = 0.0f;
+                bool mFocused = false;
+                bool mCursorShown = false;
+                bool mHovered = false;
+                float mMouseX = 0.0f; // only while hovered
+                float mMouseY = 0.0f;
+
+                bool operator==(const FrameState &) const = default;
         };
 
         class UndoRecord
@@ -205,7 +411,59 @@ class TextEditor
         void Colorize(int aFromLine = 0, int aCount = -1);
         void ColorizeRange(int aFromLine = 0, int aToLine = 0);
         void ColorizeInternal();
+        void ColorizeLine(Line &aLine) const;
+        template<typename CharIterator, typename TokenizeFunction>
+        void TokenizeLine(Line &aLine, CharIterator aBegin, CharIterator aEnd, TokenizeFunction aTokenize) const;
+        void InvalidateScan(int aFromLine, int aToLine);
+        void ColorizeVisibleLines(const std::chrono::steady_clock::time_point &aDeadline);
+        int ColorizeQueuedLines(int aFromLine, int aToLine, int aMaxLines);
+        void ScanComments(int aMaxLines);
+        template<typename LineIterator>
+        int ScanLineRun(LineIterator aBegin,
+                        LineIterator aEnd,
+                        int aFirstLine,
+                        int aToLine,
+                        LineRanges *aRetokenize) const;
+        uint8_t ScanLine(Line &aLine, uint8_t aState, bool &aPreprocessorChanged) const;
+        int FindScanStart(int aLine) const;
+        int GetColorizeIncrement() const;
+        void ColorizeDocumentParallel(int aThreadCount);
+        void SubmitColorizeJob();
+        void RunColorizeJob(ColorizeJob &aJob) const;
+        void ApplyColorizeJob(const ColorizeJob &aJob);
         float TextDistanceToLineStart(const Coordinates &aFrom) const;
+        const std::vector<float> &GetLineLayout(int aLine) const;
+        float MeasureLine(const Line &aLine, float *aOffsets) const;
+        const std::vector<uint32_t> &GetLineWraps(int aLine) const;
+        uint32_t CountLineRows(const Line &aLine);
+        void UpdateWrap(float aWidth);
+        int GetLineRow(int aLine) const;
+        Coordinates GetRowCoordinates(int aLine, int aRow, float aX) const;
+        Coordinates MoveRows(const Coordinates &aFrom, int aRows) const;
+        bool HasGlyphAdvances() const;
+        bool IsOnGrid(const Line &aLine) const;
+        void UpdateLineWidths();
+        float GetLongestLineWidth() const;
+        void UncountLineWidth(Line &aLine);
+        void UpdateLayoutKey();
+        void UpdateGutter(int aFirstLine, int aLastLine);
+        float GetMinimapWidth() const;
+        void DrawMinimap(ImDrawList *aDrawList, int aFirstLine, int aLastLine);
+        void BuildMinimapTile(int aTile);
+        void InsertMinimapLines(int aIndex, int aCount);
+        void EraseMinimapLines(int aFirst, int aLast);
+        void TrimMinimapTiles(int aFromTile, int aToTile);
+        bool HandleMinimapInputs();
+        void CaptureFrameState(FrameState &aFrame) const;
+        double GetDocumentHeight() const;
+        double GetScrollRange() const;
+        double GetScrollTop() const;
+        float GetLineScreenY(int aLine) const;
+        int GetScreenYLine(float aY, int *aRow = nullptr) const;
+        void ScrollToY(double aY);
+        void UpdateScroll();
+        void ClearLineRanges();
+        void TrimLineLayouts(int aFromLine, int aToLine);
         void EnsureCursorVisible();
         int GetPageSize() const;
         std::string GetText(const Coordinates &aStart, const Coordinates &aEnd) const;
@@ -228,17 +486,37 @@ class TextEditor
         void RemoveLine(int aStart, int aEnd);
         void RemoveLine(int aIndex);
         Line &InsertLine(int aIndex);
+        void InsertLines(int aIndex, std::vector<Line> &&aLines);
         void EnterCharacter(ImWchar aChar, bool aShift);
         void Backspace();
         void DeleteSelection();
         std::string GetWordUnderCursor() const;
         std::string GetWordAt(const Coordinates &aCoords) const;
-        ImU32 GetGlyphColor(const Glyph &aGlyph) const;
+        void UpdatePalette();
+        void DrawLineText(ImDrawList *aDrawList,
+                          Line &aLine,
+                          const std::vector<float> &aLayout,
+                          const std::vector<uint32_t> &aWraps,
+                          const ImVec2 &aTextPos,
+                          float aClipLeft,
+                          float aClipRight,
+                          float aClipTop,
+                          float aClipBottom);
+        void DrawGlyphs(ImDrawList *aDrawList,
+                        const Line &aLine,
+                        const std::vector<float> &aLayout,
+                        const ImVec2 &aTextPos,
+                        size_t aFrom,
+                        size_t aTo);
+        void DrawLineMesh(ImDrawList *aDrawList, const Line::Mesh &aMesh, const ImVec2 &aTextPos);
+        void UpdateWhitespaceMarkers();
+        void DrawWhitespaceMarkers(ImDrawList *aDrawList, const ImVec2 &aTextPos);
 
         void HandleKeyboardInputs();
         void HandleMouseInputs();
         void Render();
 
+        Colorizer mColorizer;
         float mLineSpacing;
         Lines mLines;
         EditorState mState;
@@ -253,28 +531,80 @@ class TextEditor
         bool mScrollToTop;
         bool mTextChanged;
         bool mColorizerEnabled;
+        int mColorizeThreadCount;
+        int mColorizeTimeBudget;
+        bool mColorizeInBackground;
+        int mColorizeLookahead; // lines the next background scan copies past its queued lines
         float mTextStart; // position (in pixels) where a code line starts relative to the left of the TextEditor.
         int mLeftMargin;
         bool mCursorPositionChanged;
-        int mColorRangeMin, mColorRangeMax;
+        LineRanges mColorRanges; // lines queued for tokenizing
         SelectionMode mSelectionMode;
         bool mHandleKeyboardInputs;
         bool mHandleMouseInputs;
         bool mIgnoreImGuiChild;
         bool mShowWhitespaces;
+        bool mMonospace;
+        bool mRetainedRendering;
+        bool mWordWrap;
+        bool mShowMinimap;
 
         Palette mPaletteBase{};
-        Palette mPalette{};
+        Palette mPalette{}; // mPaletteBase with the style alpha applied
+        float mPaletteAlpha; // style alpha mPalette was resolved with, negative if it has to be resolved again
+        std::array<ImU32, 256> mStyleColors{}; // color of each glyph style, see Line::GetStyle()
         LanguageDefinition mLanguageDefinition;
-        RegexList mRegexList;
+        RegexDFA mRegexDFA;
+        RegexList mRegexList; // only used when the token rules could not be compiled into mRegexDFA
 
-        bool mCheckComments;
+        // Lines that need rescanning for comments and preprocessor directives; a scan continues past
+        // each range until a line's saved start state matches again
+        LineRanges mScanRanges;
+        uint64_t mDocumentVersion; // bumped whenever lines are changed or queued for colorizing
         Breakpoints mBreakpoints;
         ErrorMarkers mErrorMarkers;
         ImVec2 mCharAdvance;
+        // Identifies the font, font size and tab size the cached line layouts were measured with
+        uint32_t mLayoutKey;
+        const GlyphAdvances *mGlyphAdvances; // of the current font and size, set at the start of each frame
+        uint32_t mGlyphGeneration;
+        mutable LineRanges mLayoutLines; // lines with a cached layout
+        // Number of lines of each width, the last one sizes the horizontal scroll extent
+        std::map<float, int> mLineWidths;
+        LineRanges mWidthRanges; // lines whose width has to be counted anew
+        uint32_t mWidthKey; // layout key mLineWidths was counted with, 0 for none
+        float mPreviousLongestWidth; // longest line before the count was started anew, until it is done
+        // Identifies the layouts, palette, whitespace setting and horizontal clipping line meshes were recorded with
+        uint32_t mMeshKey;
+        float mMeshClipX; // start of the text relative to the clip rect, as of the last frame
+        float mMeshClipWidth;
+        uint32_t mMeshLayoutKey; // layout key as of the last frame
+        uint32_t mMarkersVersion; // bumped when error markers or breakpoints are set
+        FrameState mFrameState; // as of the last frame
+        bool mFrameChanged; // the last frame differed from the one before
+        // Word wrap: lines are wrapped to mWrapWidth, and the tree of lines holds the rows of each
+        float mWrapWidth;
+        uint32_t mWrapLayoutKey; // layout key the rows were counted with, 0 for none
+        uint32_t mWrapKey; // identifies the width and layouts of the lines' cached wraps
+        LineRanges mWrapRanges; // lines whose rows have to be counted anew
+        std::vector<float> mWrapOffsets; // glyph offsets of the line being wrapped off screen
+        // The vertical scroll position: the line at the top of the window, the row of it and how far that
+        // is scrolled out
+        bool mVirtualScroll; // the document is too tall for ImGui to scroll through precisely
+        int mTopLine;
+        int mTopRow;
+        float mTopOffset;
+        float mScrollY; // scroll position ImGui was given by the last frame
+        float mViewHeight; // height ImGui scrolls the document through, as of the start of the frame
         Coordinates mInteractiveStart, mInteractiveEnd;
         std::string mLineBuffer;
+        Gutter mGutter;
+        Minimap mMinimap;
+        WhitespaceMarkers mWhitespaceMarkers;
+        std::vector<float> mSpaceMarkers; // centers of the spaces of the line being drawn
+        std::vector<std::pair<float, float>> mTabMarkers; // start and end of its tab arrows
         uint64_t mStartTime;
 
         float mLastClick;
+
 };
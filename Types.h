@@ -108,15 +108,12 @@ struct Identifier
         std::string mDeclaration{};
 };
 
-struct Glyph
+// Per-glyph flags maintained by the comment/preprocessor scanner
+enum class GlyphFlag : uint8_t
 {
-        Char mChar;
-        PaletteIndex mColorIndex = PaletteIndex::Default;
-        bool mComment : 1 = false;
-        bool mMultiLineComment : 1 = false;
-        bool mPreprocessor : 1 = false;
-
-        Glyph(const Char aChar, const PaletteIndex aColorIndex): mChar(aChar), mColorIndex(aColorIndex) {}
+    Comment = 1 << 0,
+    MultiLineComment = 1 << 1,
+    Preprocessor = 1 << 2
 };
 
 using Identifiers = std::unordered_map<std::string, Identifier>;
@@ -127,5 +124,3 @@ using TokenizeCallback = bool (*)(const char *in_begin,
                                   const char *&out_begin,
                                   const char *&out_end,
                                   PaletteIndex &paletteIndex);
-using Line = std::vector<Glyph>;
-using Lines = std::vector<Line>;